@@ -0,0 +1,22 @@
+/*
+ * Helpers shared by the benchmarks in each phase's bench directory.
+ */
+
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <sys/time.h>
+
+/*
+ * Seconds of host (wall clock) time, so a benchmark's speed can be read
+ * in real time whichever clock USLOSS is run in.
+ */
+
+static inline double hostSeconds(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+#endif
@@ -6,6 +6,7 @@
 #define _PHASE1_H
 
 #include <usloss.h>
+#include <procstats.h>   // ProcStats
 
 /*
  * Maximum number of processes. 
@@ -13,6 +14,21 @@
 
 #define MAXPROC      50
 
+/*
+ * The process table starts out with MAXPROC slots.  Setting the
+ * PHASE1_MAXPROCS kernel parameter (an environment variable read at boot)
+ * lets it grow, up to this many processes.
+ */
+
+#define PROC_TABLE_LIMIT  4000
+
+/*
+ * Bytes in each PCB that later phases can claim with registerProcExtension()
+ * for their own per-process state.
+ */
+
+#define PROC_EXT_SIZE     512
+
 /*
  * Maximum length of a process name
  */
@@ -32,6 +48,15 @@
 #define MAXSYSCALLS  50
 
 
+/*
+ * Handler kinds for enterCpuMode(), which splits each process's CPU time
+ * into user, kernel and interrupt time.
+ */
+
+#define CPU_KERNEL      1   // handling a system call
+#define CPU_INTERRUPT   2   // handling a device interrupt
+
+
 /* 
  * These functions must be provided by Phase 1.
  */
@@ -39,14 +64,41 @@
 extern void phase1_init(void);
 extern int  fork1(char *name, int(*func)(char *), char *arg,
                   int stacksize, int priority);
+extern int  fork1Quantum(char *name, int(*func)(char *), char *arg,
+                  int stacksize, int priority, int quantum);
 extern int  join(int *status);
 extern void quit(int status) __attribute__((__noreturn__));
 extern void zap(int pid);
 extern int  isZapped(void);
+extern int  getProcGroup(int pid);
+extern int  setProcGroup(int pid, int pgid);
+extern int  zapGroup(int pgid);
 extern int  getpid(void);
+extern int  procIndex(int pid);
+extern int  registerProcExtension(int size);
+extern void *procExtension(int pid, int handle);
+extern void *myProcExtension(int handle);
+extern int  getProcStats(int pid, ProcStats *stats);
 extern void dumpProcesses(void);
+extern int  setTickets(int pid, int tickets);
+extern void dumpShares(void);
+extern void dumpCpuModes(void);
+extern int  setRealTime(int pid, int period, int budget);
+extern void dumpDeadlines(void);
+extern void dumpSlices(void);
+extern void dumpStackProfile(void);
 extern void blockMe(int block_status);
+extern void blockMeHandoff(int block_status, int pid);
+extern void blockMeOn(int block_status, int owner_pid);
+extern int  yieldTo(int pid);
+extern int  setWaitOwner(int pid, int owner_pid);
 extern int  unblockProc(int pid);
+extern void reschedule(void);
+extern int  queueKernelTask(void (*func)(int, int), int arg1, int arg2);
+extern void requestTick(int time);
+extern int  enterCpuMode(int mode, int intType);
+extern void leaveCpuMode(int token);
+extern long long interruptTime(int intType);
 extern int  readCurStartTime(void);
 extern void timeSlice(void);
 extern int  readtime(void);
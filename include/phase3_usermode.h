@@ -5,6 +5,13 @@
 #ifndef _PHASE3_USERMODE_H
 #define _PHASE3_USERMODE_H
 
+#include <procstats.h>  // ProcStats
+
+// syscalls added past the ones usyscall.h defines, in the room it leaves
+// below USLOSS_MAX_SYSCALLS
+#define SYS_SETREALTIME     43
+#define SYS_YIELDTO         44
+
 // Phase 3 -- User Function Prototypes
 extern int  Spawn(char *name, int (*func)(char*), char *arg, int stack_size,
                   int priority, int *pid);
@@ -12,10 +19,16 @@ extern int  Wait(int *pid, int *status);
 extern void Terminate(int status) __attribute__((__noreturn__));
 extern void GetTimeofDay(int *tod);
 extern void CPUTime(int *cpu);
+extern int  GetProcInfo(int pid, ProcStats *stats);
+extern int  SetRealTime(int pid, int period, int budget);
+extern int  YieldTo(int pid);
 extern void GetPID(int *pid);
 extern int  SemCreate(int value, int *semaphore);
 extern int  SemP(int semaphore);
 extern int  SemV(int semaphore);
+extern int  LockCreate(int *lock);
+extern int  LockAcquire(int lock);
+extern int  LockRelease(int lock);
 
    // NOTE: No SemFree() call, it was removed
 
@@ -0,0 +1,42 @@
+/*
+ * The scheduling statistics phase 1 keeps for each process.  Kept apart
+ * from phase1.h so that user-mode code, which gets them from
+ * GetProcInfo(), can have the record without the kernel interface.
+ */
+
+#ifndef _PROCSTATS_H
+#define _PROCSTATS_H
+
+/*
+ * Scheduling statistics kept for every process, returned by
+ * getProcStats().  Block times are kept per block status; statuses at or
+ * above MAX_BLOCK_STATUS share the last entry.  All times are in
+ * microseconds and include the state the process is in right now.
+ */
+
+#define MAX_BLOCK_STATUS  64
+
+typedef struct ProcStats {
+    int pid;
+    int priority;               // priority the process was forked at
+    int runPriority;            // priority it is currently scheduled at
+    int cpuTime;                // time on the CPU
+    int waitTime;               // time runnable but waiting for the CPU
+    int blockTime;              // time blocked, for any reason
+    int blockTimeByStatus[MAX_BLOCK_STATUS];
+    int voluntarySwitches;      // gave up the CPU by blocking, quitting or yielding
+    int involuntarySwitches;    // lost the CPU to preemption
+    int sliceExpirations;       // time slices used up
+    int agingPromotions;        // levels gained by waiting on a run queue
+    int childrenForked;
+    int childrenReaped;
+    int stackSize;              // bytes of stack the process was given
+    int stackPeak;              // deepest it has used its stack
+    int deadlineMisses;         // EDF periods that ended with the process still runnable
+    int budgetOverruns;         // EDF periods it used up its whole budget in
+    int userTime;               // CPU time running its own code in user mode
+    int kernelTime;             // CPU time in kernel mode, outside interrupt handlers
+    int interruptTime;          // CPU time handling device interrupts that arrived while it ran
+} ProcStats;
+
+#endif
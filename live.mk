@@ -0,0 +1,72 @@
+# "make live": links a phase's testcases against phase 1-3 libraries built
+# from the sources in this tree (phase1b, phase2, phase3) instead of the
+# prebuilt libphaseN.a next to its Makefile, runs them, and reports which
+# ones match their expected output (or any of its .out-N alternates).
+#
+# Only the names the headers in include/ declare extern are left global
+# in the built libraries, so their helpers can't clash with the phase
+# being tested. The testcases are linked through the Makefile's own rules,
+# with PHASE_LIBS, the prebuilt archives they depend on, pointed at the
+# built ones. A Makefile sets these, then includes this file:
+#   LIVE_LIBS       libraries to build, eg. ${LIVE_DIR}/libphase1.a
+#   LIVE_RUN_FLAGS  arguments each testcase is run with
+#   LIVE_TERM_OUT   non-empty to append term[0-3].out to the output, as
+#                   that phase's run_testcases.student does
+
+LIVE_DIR = live_build
+LIVE_TIMEOUT = 60
+
+live: ${LIVE_LIBS}
+	@for t in ${TESTS}; do \
+	    rm -f $$t term[0-3].out; \
+	    if ! ${MAKE} -s $$t PHASE_LIBS="${LIVE_LIBS}" LDFLAGS="-Wl,--start-group -L${LIB_DIR} -L${LIVE_DIR} -L. ${LIBS} -Wl,--end-group" >/dev/null || [ ! -x $$t ]; then \
+	        echo "$$t BUILD FAILED"; continue; \
+	    fi; \
+	    timeout ${LIVE_TIMEOUT} ./$$t ${LIVE_RUN_FLAGS} > ${LIVE_DIR}/$$t.out 2>&1; \
+	    if [ -n "${LIVE_TERM_OUT}" ]; then \
+	        for x in term[0-3].out; do \
+	            if [ -s $$x ]; then echo "----- $$x -----" >> ${LIVE_DIR}/$$t.out; cat $$x >> ${LIVE_DIR}/$$t.out; fi; \
+	        done; \
+	    fi; \
+	    result=FAIL; \
+	    for e in testcases/$$t.out testcases/$$t.out-*; do \
+	        if [ -f $$e ] && cmp -s $$e ${LIVE_DIR}/$$t.out; then result=PASS; fi; \
+	    done; \
+	    echo "$$t $$result"; \
+	done
+
+${LIVE_DIR}/exports: $(wildcard ${INCLUDE_DIR}/*.h)
+	mkdir -p ${LIVE_DIR}
+	cat $^ | grep '^extern' | grep -o '[A-Za-z_][A-Za-z0-9_]*' | sort -u > $@
+
+# compile a phase's source, then localize everything it defines that no
+# header exports
+define LIVE_COMPILE
+	${CC} -I$(dir $<) ${CFLAGS} -c $< -o $@
+	nm -g --defined-only $@ | awk '{print $$3}' | grep -xFf ${LIVE_DIR}/exports > $@.syms
+	objcopy --keep-global-symbols=$@.syms $@
+endef
+
+${LIVE_DIR}/phase1.o: ${PREFIX}/phase1b/phase1.c ${LIVE_DIR}/exports
+	$(LIVE_COMPILE)
+
+${LIVE_DIR}/phase2.o: ${PREFIX}/phase2/phase2.c ${LIVE_DIR}/exports
+	$(LIVE_COMPILE)
+
+${LIVE_DIR}/phase3.o: ${PREFIX}/phase3/phase3.c ${LIVE_DIR}/exports
+	$(LIVE_COMPILE)
+
+${LIVE_DIR}/phase3_usermode.o: ${PREFIX}/phase3/phase3_usermode.c ${LIVE_DIR}/exports
+	${CC} -I$(dir $<) ${CFLAGS} -c $< -o $@
+
+${LIVE_DIR}/libphase1.a: ${LIVE_DIR}/phase1.o
+	rm -f $@
+	ar rc $@ $^
+
+${LIVE_DIR}/libphase2.a: ${LIVE_DIR}/phase2.o
+	rm -f $@
+	ar rc $@ $^
+
+${LIVE_DIR}/libphase3.a: ${LIVE_DIR}/phase3.o ${LIVE_DIR}/phase3_usermode.o
+	rm -f $@
+	ar rc $@ $^
@@ -0,0 +1,123 @@
+/*
+ * Dispatcher microbenchmark.
+ *
+ * testcase_main() (priority 3) forks a set of priority 2 workers, each of
+ * which loops on blockMe().  testcase_main() then repeatedly unblockProc()s
+ * every worker; each wakeup preempts testcase_main(), and the worker blocks
+ * again right away, so every iteration should be two context switches.  The
+ * dispatches reported are the switches getProcStats() counted for
+ * testcase_main() and the workers, so any others are seen too.  A number of
+ * priority 5 processes are also left sitting on the run queue to represent
+ * background load, so the cost can be read off against the number of
+ * runnable processes.
+ *
+ * Output is one line per configuration, in key=value form, so results can
+ * be compared across kernel changes.  BENCH_CLOCK, set by 'make bench',
+ * records whether USLOSS was run in real or (-R) virtual time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <bench.h>
+
+#define BENCH_BLOCKED   20
+#define ROUNDS          2000
+
+int worker(char *);
+int filler(char *);
+
+char *clockName;
+int done;
+int fillersDone;
+
+// context switches away from testcase_main() and the workers so far, as
+// the dispatcher counts them
+static long switches(int *pids, int numWorkers)
+{
+    ProcStats stats;
+    long total = 0;
+
+    getProcStats(getpid(), &stats);
+    total += stats.voluntarySwitches + stats.involuntarySwitches;
+    for (int i = 0; i < numWorkers; i++)
+    {
+        getProcStats(pids[i], &stats);
+        total += stats.voluntarySwitches + stats.involuntarySwitches;
+    }
+    return total;
+}
+
+static void runConfig(int numWorkers, int numFillers)
+{
+    int pids[MAXPROC];
+    int status;
+
+    done = 0;
+    fillersDone = 0;
+    for (int i = 0; i < numWorkers; i++)
+        pids[i] = fork1("worker", worker, NULL, USLOSS_MIN_STACK, 2);
+    for (int i = 0; i < numFillers; i++)
+        fork1("filler", filler, NULL, USLOSS_MIN_STACK, 5);
+
+    long switchesStart = switches(pids, numWorkers);
+    int simStart = currentTime();
+    double hostStart = hostSeconds();
+
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (int i = 0; i < numWorkers; i++)
+        {
+            unblockProc(pids[i]);    // switch to the worker, which blocks again
+        }
+    }
+
+    double hostElapsed = hostSeconds() - hostStart;
+    int simElapsed = currentTime() - simStart;
+    long dispatches = switches(pids, numWorkers) - switchesStart;
+
+    USLOSS_Console("BENCH dispatch clock=%s workers=%d fillers=%d dispatches=%ld host_sec=%.3f dispatches_per_sec=%.0f sim_us=%d\n",
+                   clockName, numWorkers, numFillers, dispatches, hostElapsed,
+                   dispatches / hostElapsed, simElapsed);
+
+    // let the workers and then the fillers exit, so the next
+    // configuration starts with an empty run queue
+    done = 1;
+    for (int i = 0; i < numWorkers; i++)
+    {
+        unblockProc(pids[i]);
+        join(&status);
+    }
+    fillersDone = 1;
+    for (int i = 0; i < numFillers; i++)
+        join(&status);
+}
+
+int testcase_main()
+{
+    clockName = getenv("BENCH_CLOCK") ? getenv("BENCH_CLOCK") : "unknown";
+
+    runConfig(1, 0);
+    runConfig(1, 8);
+    runConfig(1, 24);
+    runConfig(1, 40);
+    runConfig(8, 0);
+    runConfig(8, 8);
+    runConfig(24, 8);
+    return 0;
+}
+
+int worker(char *arg)
+{
+    while (!done)
+        blockMe(BENCH_BLOCKED);
+    return 0;
+}
+
+int filler(char *arg)
+{
+    while (!fillersDone)
+        ;
+    return 0;
+}
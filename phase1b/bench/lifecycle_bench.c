@@ -0,0 +1,154 @@
+/*
+ * Process lifecycle microbenchmark.
+ *
+ * Measures the kernel paths a process goes through over its life, each in
+ * isolation:
+ *
+ *   fork_join   testcase_main() (priority 3) forks a priority 2 child that
+ *               returns at once, then join()s it.  One round is a fork1(),
+ *               two dispatches, a quit() and a join().
+ *   pingpong    a priority 2 partner blocks; testcase_main() wakes it with
+ *               unblockProc() and the partner blocks again.  One round is
+ *               a wakeup and two context switches.
+ *   zap         a batch of blocked priority 4 children is torn down, either
+ *               by zap()ing them one at a time or with a single zapGroup(),
+ *               and then join()ed.
+ *
+ * Output is one line per measurement, in key=value form, so results can be
+ * compared across kernel changes.  sim_us is USLOSS time, so it only means
+ * CPU time when the benchmark is run with -R (virtual time); the BENCH_CLOCK
+ * environment variable, set by 'make bench', records which clock was used.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <bench.h>
+
+#define BENCH_BLOCKED   20
+#define FORK_ROUNDS     2000
+#define PINGPONG_ROUNDS 5000
+#define ZAP_ROUNDS      50
+
+int child(char *);
+int partner(char *);
+int victim(char *);
+
+char *clockName;
+int done;
+
+static void report(char *name, char *config, int rounds, double hostElapsed, int simElapsed)
+{
+    USLOSS_Console("BENCH %s clock=%s%s rounds=%d host_sec=%.3f rounds_per_sec=%.0f host_ns_per_round=%.0f sim_us=%d sim_us_per_round=%.2f\n",
+                   name, clockName, config, rounds, hostElapsed, rounds / hostElapsed,
+                   hostElapsed * 1e9 / rounds, simElapsed, (double)simElapsed / rounds);
+}
+
+static void benchForkJoin(void)
+{
+    int status;
+    int simStart = currentTime();
+    double hostStart = hostSeconds();
+
+    for (int r = 0; r < FORK_ROUNDS; r++)
+    {
+        fork1("child", child, NULL, USLOSS_MIN_STACK, 2);
+        join(&status);
+    }
+
+    report("fork_join", "", FORK_ROUNDS, hostSeconds() - hostStart, currentTime() - simStart);
+}
+
+static void benchPingPong(void)
+{
+    int status;
+    done = 0;
+    int pid = fork1("partner", partner, NULL, USLOSS_MIN_STACK, 2);
+
+    int simStart = currentTime();
+    double hostStart = hostSeconds();
+
+    for (int r = 0; r < PINGPONG_ROUNDS; r++)
+        unblockProc(pid);
+
+    report("pingpong", "", PINGPONG_ROUNDS, hostSeconds() - hostStart, currentTime() - simStart);
+
+    done = 1;
+    unblockProc(pid);
+    join(&status);
+}
+
+static void benchZap(int numVictims, int useGroup)
+{
+    int pids[MAXPROC];
+    int status;
+    double hostElapsed = 0;
+    int simElapsed = 0;
+
+    for (int r = 0; r < ZAP_ROUNDS; r++)
+    {
+        for (int i = 0; i < numVictims; i++)
+        {
+            pids[i] = fork1("victim", victim, NULL, USLOSS_MIN_STACK, 4);
+            setProcGroup(pids[i], pids[0]);
+        }
+
+        // the victims all run and block before a priority 5 child can quit
+        fork1("child", child, NULL, USLOSS_MIN_STACK, 5);
+        join(&status);
+
+        int simStart = currentTime();
+        double hostStart = hostSeconds();
+
+        // a victim notices the zap the next time it wakes up
+        for (int i = 0; i < numVictims; i++)
+            unblockProc(pids[i]);
+        if (useGroup)
+            zapGroup(pids[0]);
+        else
+            for (int i = 0; i < numVictims; i++)
+                zap(pids[i]);
+        for (int i = 0; i < numVictims; i++)
+            join(&status);
+
+        hostElapsed += hostSeconds() - hostStart;
+        simElapsed += currentTime() - simStart;
+    }
+
+    char config[64];
+    snprintf(config, sizeof(config), " victims=%d method=%s", numVictims, useGroup ? "zapGroup" : "zap");
+    report("zap", config, ZAP_ROUNDS, hostElapsed, simElapsed);
+}
+
+int testcase_main()
+{
+    clockName = getenv("BENCH_CLOCK") ? getenv("BENCH_CLOCK") : "unknown";
+
+    benchForkJoin();
+    benchPingPong();
+    benchZap(8, 0);
+    benchZap(8, 1);
+    benchZap(32, 0);
+    benchZap(32, 1);
+    return 0;
+}
+
+int child(char *arg)
+{
+    return 0;
+}
+
+int partner(char *arg)
+{
+    while (!done)
+        blockMe(BENCH_BLOCKED);
+    return 0;
+}
+
+int victim(char *arg)
+{
+    while (!isZapped())
+        blockMe(BENCH_BLOCKED);
+    return 0;
+}
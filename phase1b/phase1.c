@@ -13,14 +13,40 @@
  * in both its current time slice and total time on CPU.
  */
 
+#include <errno.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 #include "phase1.h"
+#include "trace.h"
 
 #define NUMPRIORITIES   7
 #define MAX_TIME_SLICE  80000
+#define NO_TICK         INT_MAX // nextTick when no later phase needs the clock
+
+// scheduling modes (PHASE1_SCHED kernel parameter)
+#define SCHED_PRIORITY  0   // fixed priority round robin
+#define SCHED_MLFQ      1   // multi-level feedback queue
+#define SCHED_STRIDE    2   // stride scheduling (proportional share) for priorities 2-5
+
+#define STRIDE_PRIORITY 2           // run queue shared by every stride scheduled process
+#define STRIDE1         (1 << 20)   // stride of a process holding one ticket
+#define DEFAULT_TICKETS 100
+
+#define EDF_PRIORITY    0           // run queue of EDF processes, ahead of every fixed priority
+#define PPM             1000000     // EDF utilization is kept in parts per million
+
+#define NUM_STACK_CLASSES   32  // stack size classes, one per power of two
+#define PCB_CHUNK           MAXPROC // PCBs allocated each time the pool runs dry
+#define GROUP_BUCKETS       64      // buckets in the pgid -> ProcGroup hash table
+#define PROFILE_BUCKETS     64      // buckets in the name -> StackProfile hash table
+#define STACK_MARGIN        (16 * 1024) // least headroom left above a profiled stack peak
+#define TASK_QUEUE_SIZE     256     // kernel tasks that can be pending at once
+#define TASK_STACK_SIZE     USLOSS_MIN_STACK // stack kernel tasks run on
 
 // run states
 #define RUNNABLE    0
@@ -28,45 +54,139 @@
 #define BLOCKED     2
 #define DEAD        3
 
+// what a process is doing on the CPU; CPU_KERNEL and CPU_INTERRUPT are in phase1.h
+#define CPU_BASE    0   // running its own code, in user or kernel mode
+#define MODE_TOKEN(mode, intType)   ((intType) << 2 | (mode)) // enterCpuMode()'s return value
+
 // block reasons (ie, why is this process blocked?)
 #define UNBLOCKED   0
 #define ZAPPING     21
 #define JOINING     22
 
 /**
- * Data structure used for maintaining PCB information
+ * Data structure used for maintaining PCB information. Fields are grouped
+ * by how often they are touched: the dispatcher, clock handler and wakeup
+ * paths only read the first group, so a PCB's hot state sits in a couple
+ * of cache lines ahead of the large saved context
  */
 typedef struct PCB {
+    // hot: read on every dispatch, wakeup and clock tick
     int pid;
+    int index;                  // position in the PCB pool, fixed for the PCB's lifetime
     int priority;
-    int status;
-
-    char arg[MAXARG];
-    char processName[MAXNAME];
-
-    int (*processMain)(char*);
-    void* stackMem;
-    USLOSS_Context context;
-
+    int runPriority;            // priority the dispatcher currently schedules this proc at
     char isAllocated;
     char runState;
     int blockStatus;
-    
+
     int currentStartTime;
+    int sliceStart;             // when the current time slice began; donated on handoff
+    int quantum;                // time slice set at fork1Quantum(), 0 to use quantumTable
     int totalCpuTime;
+    int stateSince;             // when the process entered its current runState
+    char cpuMode;               // CPU_BASE, CPU_KERNEL or CPU_INTERRUPT
+    char cpuIntType;            // interrupt (or syscall) being handled, if not CPU_BASE
+    int modeSince;              // when the process entered cpuMode
+
+    struct PCB* prevInQueue;    // Prev process in PCBs run queue 
+    struct PCB* nextInQueue;    // Next process in PCBs run queue
+
+    int tickets;                // share of the CPU under stride scheduling
+    long long pass;             // stride scheduling virtual time; lowest pass runs next
+
+    int period;                 // EDF period in microseconds, 0 if not in the EDF class
+    int budget;                 // CPU time the process may use each period
+    int budgetLeft;             // budget not yet used in the current period
+    int deadline;               // end of the current period
+    struct PCB* nextEdf;        // next process in the list of EDF processes
+
+    int boostedFrom;            // runPriority before priority inheritance raised it, 0 if not boosted
+    int agedFrom;               // runPriority before aging raised it, 0 if not aged
+    struct PCB* blockedOn;      // owner this proc is lending its priority to while blocked
+    struct PCB* donors;         // head of list of procs blocked on this proc
+    struct PCB* nextDonor;      // next (after this) in owner's list of donors
+
+    // warm: process lifecycle and bookkeeping
+    int status;
+    ProcStats stats;            // counters reported by getProcStats()
 
     struct PCB* parent;
     struct PCB* child;
     struct PCB* prevSibling;
     struct PCB* nextSibling;
 
+    struct PCB* deadHead;       // head of list of this proc's children that have quit() but not been join()ed
+    struct PCB* deadTail;       // tail of that list
+    struct PCB* nextDead;       // next (after this) in parent's list of dead children
+
     struct PCB* zappedBy;       // head of list of procs currently zap()-ing this proc
     struct PCB* nextZapper;     // next (after this) in list of procs zap()-ing some OTHER proc
+    struct ProcGroup* zappedWith; // group this proc was zapped along with by zapGroup(), if any
 
-    struct PCB* prevInQueue;    // Prev process in PCBs run queue 
-    struct PCB* nextInQueue;    // Next process in PCBs run queue
+    struct ProcGroup* group;    // process group this proc belongs to
+    struct PCB* prevInGroup;    // Prev process in group's member list
+    struct PCB* nextInGroup;    // Next process in group's member list
+
+    struct PCB* nextFree;       // next unused PCB in the pool's free list
+
+    // per-process state of later phases, carved up by registerProcExtension()
+    long long ext[PROC_EXT_SIZE / sizeof(long long)];
+
+    // cold: only used by fork1(), quit(), dumps and the context switch itself
+    char arg[MAXARG];
+    char processName[MAXNAME];
+
+    int (*processMain)(char*);
+    void* stackMem;
+    int stackClass;             // size class stackMem was taken from
+    int stackUsable;            // bytes at the top of the stack that are accessible
+    int stackPeak;              // deepest stack use, measured at quit()
+    USLOSS_Context context;
 } PCB;
 
+/**
+ * Header kept at the top of a pooled stack while it sits on a free list
+ */
+typedef struct FreeStack {
+    struct FreeStack* next;
+    char* stackMem;             // lowest address of the stack
+    int usable;                 // bytes at the top of the stack that are accessible
+} FreeStack;
+
+/**
+ * Deepest stack use seen by processes of one name, for sizing the stacks
+ * of later processes with that name
+ */
+typedef struct StackProfile {
+    char name[MAXNAME + 1];
+    int peak;                   // deepest stack use in bytes
+    int samples;                // processes with this name that have quit
+    struct StackProfile* next;  // next profile in the same stackProfiles bucket
+} StackProfile;
+
+/**
+ * Data structure used for maintaining a process group, the set of
+ * processes that zapGroup() zaps together
+ */
+typedef struct ProcGroup {
+    int pgid;
+    int members;                // processes in the group, including ones that have quit but not been join()ed
+    PCB* head;                  // head of list of members
+    int zapPending;             // members marked by zapGroup() that have not quit yet
+    PCB* zappers;               // head of list of procs blocked in zapGroup() on this group
+    struct ProcGroup* next;     // next group in the same groupTable bucket
+} ProcGroup;
+
+/**
+ * A run-to-completion callback queued by an interrupt handler, with the
+ * two arguments it is called with
+ */
+typedef struct KernelTask {
+    void (*func)(int, int);
+    int arg1;
+    int arg2;
+} KernelTask;
+
 /**
  * Data structure used for maintaining run queues for dispatcher
  */
@@ -78,11 +198,62 @@ typedef struct Queue {
 
     /* ---------- Globals ---------- */
 
-PCB processes[MAXPROC]; // process table
+PCB** procTable;        // process table, pid -> PCB, process with pid p lives in slot p % procTableSize
+int procTableSize;      // number of slots in procTable
+int liveProcs;          // number of slots in procTable in use
+int maxProcs;           // most processes allowed at once (PHASE1_MAXPROCS kernel parameter)
+
+PCB* pcbChunks[PROC_TABLE_LIMIT / PCB_CHUNK + 1]; // PCB pool storage, never moves
+int pcbPoolSize;        // number of PCBs allocated in pcbChunks
+PCB* freePCBs;          // head of list of unused PCBs
+int extUsed;            // bytes of every PCB's extension area handed out so far
+ProcGroup* groupTable[GROUP_BUCKETS]; // process groups, hashed by pgid
+
 PCB* currentProc;       // currently running process
 int currentPID = 1;     // next available PID
 
-Queue queues[NUMPRIORITIES]; // queues for dispatcher
+Queue queues[NUMPRIORITIES + 1]; // queues for dispatcher, indexed by runPriority (0 is EDF)
+unsigned int readyMask;      // bit runPriority is set iff that run queue is non-empty
+
+int schedMode;               // SCHED_PRIORITY, SCHED_MLFQ or SCHED_STRIDE
+long long globalPass;        // pass of the stride process dispatched most recently
+PCB* edfProcs;               // head of list of processes in the EDF class
+int edfUtil;                 // CPU share reserved by edfProcs, in parts per million
+int edfUtilMax;              // most edfUtil may grow to (PHASE1_EDF_UTIL kernel parameter, percent)
+
+int deferWakeups;            // PHASE1_DEFER_WAKEUPS kernel parameter
+int needResched;             // a wakeup was deferred; dispatch() before returning to user code
+PCB* handoffTo;              // process the next dispatch() should switch straight to, if it can
+int yielding;                // the current process gave up the CPU; dispatch() must requeue it
+int inheritPriority;         // PHASE1_INHERIT kernel parameter
+int agingRate;               // PHASE1_AGING_RATE: microseconds waited per level gained, 0 for no aging
+int agingCap;                // PHASE1_AGING_CAP: best priority aging can raise a process to
+int tickless;                // PHASE1_TICKLESS kernel parameter
+int nextTick;                // earliest time passed to requestTick(), NO_TICK if none is pending
+long long idleTicks;         // clock interrupts ignored because only the sentinel could run
+long long intTime[USLOSS_NUM_INTS];      // CPU time spent handling each interrupt type, by every process
+int mlfqQuantum[NUMPRIORITIES] = { 20000, 40000, 80000, 160000, 320000, 80000, 80000 };
+int quantumTable[NUMPRIORITIES];         // time slice at each priority (PHASE1_QUANTUM_<p> kernel parameters)
+int sliceCount[NUMPRIORITIES];           // time slices that have ended at each priority
+long long sliceTotal[NUMPRIORITIES];     // total length of those slices
+int sliceMax[NUMPRIORITIES];             // longest of those slices
+int sliceExpired[NUMPRIORITIES];         // how many of them ran the full quantum
+
+FreeStack* stackPool[NUM_STACK_CLASSES]; // free stacks, indexed by size class
+long pageSize;                           // size of the guard page below each stack
+StackProfile* stackProfiles[PROFILE_BUCKETS]; // per-name stack peaks, hashed by name
+int stackSizing;                         // PHASE1_STACK_PROFILE kernel parameter
+
+KernelTask taskQueue[TASK_QUEUE_SIZE];  // pending kernel tasks, a ring buffer
+int taskHead;                            // index of the oldest pending task
+int taskCount;                           // number of pending tasks
+int inKernelTask;                        // set while runKernelTasks() is calling tasks
+USLOSS_Context taskContext;              // runs kernel tasks, on a stack of its own
+USLOSS_Context taskReturn;               // context runKernelTasks() was called from
+
+TraceEvent* traceBuf;   // scheduler event ring buffer, NULL when tracing is off
+int traceSize;          // number of events traceBuf holds (PHASE1_TRACE kernel parameter)
+long long traceCount;   // events recorded so far; the next one goes in traceCount % traceSize
 
 
     /* ---------- Prototypes ---------- */
@@ -91,13 +262,56 @@ int disableInterrupts();
 int sentinelMain(char*);
 int testcaseMainMain(char*);
 
+int kernelParam(char*, int);
+int isStride(PCB*);
+int isEdf(PCB*);
+int edfShare(int, int);
+int basePriority(PCB*);
+int quantumFor(PCB*);
+int sliceUsedUp(PCB*, int);
+int statusSlot(int);
+
+void* allocStack(int, int, int*);
+int profiledStack(char*);
+int profiledSize(StackProfile*);
+StackProfile* findStackProfile(char*, int);
+int stackHighWater(void*, int, int);
+PCB* allocPCB();
+PCB* findProc(int);
+ProcGroup* findGroup(int);
+int isAncestor(PCB*, PCB*);
+void addToDeadList(PCB*, PCB*);
+void addToGroup(PCB*, int);
+void removeFromGroup(PCB*);
+void attachDonor(PCB*, PCB*);
+void detachDonor(PCB*);
 void addToQueue(PCB*);
+void ageProcesses(int);
+void edfTick(int);
+void newPeriod(PCB*, int);
+void leaveEdf(PCB*);
+void setBasePriority(PCB*, int);
+void chargeCpu(PCB*, int);
+void chargeMode(PCB*, int, int);
+void enterState(PCB*, int, int);
 void checkMode(char*);
+void freeStack(PCB*);
+void recordStackPeak(char*, int);
+void freePCB(PCB*);
+void growProcTable();
+void insertProc(PCB*);
 void dispatch();
 void initMain();
 void trampoline();
+void traceDump();
+void traceEvent(int, int, int);
+void recordSlice(int, int, int);
+void runKernelTasks();
+void taskMain();
 void removeFromQueue(PCB*);
 void restoreInterrupts(int);
+void setRunPriority(PCB*, int);
+void updateBoost(PCB*);
 
 static void clockHandler(int,void*);
 
@@ -115,8 +329,77 @@ static void clockHandler(int,void*);
  * None
  */ 
 void phase1_init(void) {
-    memset(processes, 0, sizeof(processes));
+    maxProcs = kernelParam("PHASE1_MAXPROCS", MAXPROC);
+    if (maxProcs < MAXPROC) { maxProcs = MAXPROC; }
+    if (maxProcs > PROC_TABLE_LIMIT) { maxProcs = PROC_TABLE_LIMIT; }
+
+    procTableSize = MAXPROC;
+    procTable = calloc(procTableSize, sizeof(PCB*));
+    memset(groupTable, 0, sizeof(groupTable));
+    liveProcs = 0;
     memset(queues, 0, sizeof(queues));
+    readyMask = 0;
+    char* sched = getenv("PHASE1_SCHED");
+    schedMode = SCHED_PRIORITY;
+    if (sched && strcmp(sched, "mlfq") == 0) { schedMode = SCHED_MLFQ; }
+    if (sched && strcmp(sched, "stride") == 0) { schedMode = SCHED_STRIDE; }
+    globalPass = 0;
+    edfProcs = NULL;
+    edfUtil = 0;
+    edfUtilMax = kernelParam("PHASE1_EDF_UTIL", 90);
+    if (edfUtilMax < 1) { edfUtilMax = 1; }
+    if (edfUtilMax > 100) { edfUtilMax = 100; }
+    edfUtilMax *= PPM / 100;
+
+    // time slice table, one entry per priority; MLFQ levels default to
+    // longer slices further down
+    char name[32];
+    for (int i = 0; i < NUMPRIORITIES; i++) {
+        int defaultQuantum = schedMode == SCHED_MLFQ ? mlfqQuantum[i] : MAX_TIME_SLICE;
+        sprintf(name, "PHASE1_QUANTUM_%d", i + 1);
+        quantumTable[i] = kernelParam(name, defaultQuantum);
+        if (quantumTable[i] <= 0) { quantumTable[i] = defaultQuantum; }
+    }
+    memset(sliceCount, 0, sizeof(sliceCount));
+    memset(sliceTotal, 0, sizeof(sliceTotal));
+    memset(sliceMax, 0, sizeof(sliceMax));
+    memset(sliceExpired, 0, sizeof(sliceExpired));
+    deferWakeups = kernelParam("PHASE1_DEFER_WAKEUPS", 0);
+    needResched = 0;
+    handoffTo = NULL;
+    yielding = 0;
+    inheritPriority = kernelParam("PHASE1_INHERIT", 1);
+    agingRate = kernelParam("PHASE1_AGING_RATE", 0);
+    agingCap = kernelParam("PHASE1_AGING_CAP", 2);
+    if (agingCap < 1) { agingCap = 1; }
+    if (agingCap > 5) { agingCap = 5; }
+    tickless = kernelParam("PHASE1_TICKLESS", 0);
+    nextTick = NO_TICK;
+    idleTicks = 0;
+    memset(intTime, 0, sizeof(intTime));
+    pageSize = sysconf(_SC_PAGESIZE);
+    stackSizing = kernelParam("PHASE1_STACK_PROFILE", 0);
+    memset(stackProfiles, 0, sizeof(stackProfiles));
+    taskHead = 0;
+    taskCount = 0;
+    inKernelTask = 0;
+    int taskStackClass;
+    void* taskStack = allocStack(TASK_STACK_SIZE, 0, &taskStackClass);
+    if (taskStack == NULL) {
+        USLOSS_Console("ERROR: no memory for the kernel task stack\n");
+        USLOSS_Halt(1);
+    }
+    USLOSS_ContextInit(&taskContext, taskStack, 1 << taskStackClass, NULL, &taskMain);
+    extUsed = 0;
+
+    // scheduler event trace, written out when the simulation halts
+    traceSize = kernelParam("PHASE1_TRACE", 0);
+    traceCount = 0;
+    traceBuf = NULL;
+    if (traceSize > 0) {
+        traceBuf = calloc(traceSize, sizeof(TraceEvent));
+        atexit(traceDump);
+    }
     USLOSS_IntVec[USLOSS_CLOCK_INT] = &clockHandler;
 }
 
@@ -135,19 +418,30 @@ void startProcesses(void) {
     int prevInt = disableInterrupts();
 
     // Create init PCB and populate fields
-    PCB* init = &processes[currentPID % MAXPROC];
+    PCB* init = allocPCB();
     init->pid = currentPID++;
     init->priority = 6;
+    init->runPriority = 6;
+    init->tickets = DEFAULT_TICKETS;
     strcpy(init->processName, "init");
     init->isAllocated = 1;
+    insertProc(init);
+    addToGroup(init, init->pid);
 
     // allocate stack, initialize context 
-    void* stackMem = malloc(USLOSS_MIN_STACK);
+    void* stackMem = allocStack(USLOSS_MIN_STACK, 0, &init->stackClass);
+    if (stackMem == NULL) {
+        USLOSS_Console("ERROR: no memory for the init stack\n");
+        USLOSS_Halt(1);
+    }
     init->stackMem = stackMem;
-    USLOSS_ContextInit(&init->context, stackMem, USLOSS_MIN_STACK, NULL, &initMain);
+    init->stackUsable = 1 << init->stackClass;
+    USLOSS_ContextInit(&init->context, stackMem, 1 << init->stackClass, NULL, &initMain);
     
     init->runState = RUNNABLE;
+    init->stateSince = currentTime();
     addToQueue(init);
+    traceEvent(TRACE_FORK, init->pid, 0);
     
     // call dispatcher to switch to init
     dispatch();
@@ -170,27 +464,78 @@ void startProcesses(void) {
  */ 
 int fork1(char *name, int (*func)(char*), char *arg, int stacksize, int priority) {
     checkMode("fork1");
+    return fork1Quantum(name, func, arg, stacksize, priority, 0);
+}
+
+/**
+ * Purpose:
+ * Creates a new process like fork1(), but with its own time slice length
+ * instead of the one quantumTable gives its priority. Lets latency
+ * sensitive daemons take short slices and batch jobs long ones
+ * 
+ * Parameters:
+ * char* name           Name for the new process to create
+ * int (*func)(char*)   Function pointer to new processes main function
+ * char* arg            Arguments to pass into processes main function
+ * int stacksize        Size of stack for process
+ * int priority         Priority to set for process
+ * int quantum          Time slice in microseconds, 0 to use quantumTable
+ *
+ * Return:
+ * int  PID of new process, -2 if stacksize is too small, -1 for any other
+ *      invalid argument or if the process table is full
+ */ 
+int fork1Quantum(char *name, int (*func)(char*), char *arg, int stacksize, int priority, int quantum) {
+    checkMode("fork1Quantum");
     int prevInt = disableInterrupts();
 
     if (stacksize < USLOSS_MIN_STACK) {
+        restoreInterrupts(prevInt);
         return -2;
     }
-    if (priority < 1 || (priority > 5 && strcmp(name, "sentinel") != 0 && priority != 7) ||
-    func == NULL || name == NULL || strlen(name) > MAXNAME) {
+    if (quantum < 0 || func == NULL || name == NULL || strlen(name) > MAXNAME) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+    if (priority < 1 || (priority > 5 && strcmp(name, "sentinel") != 0 && priority != 7)) {
+        restoreInterrupts(prevInt);
         return -1;
     }
-    int i = 0;
-    for (; i < MAXPROC && processes[currentPID % MAXPROC].isAllocated; i++) {
+    if (liveProcs >= maxProcs) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+
+    // keep the table at most half full once it is allowed to grow past
+    // MAXPROC, so the probe for a free slot below stays short
+    if (maxProcs > MAXPROC && 2 * liveProcs >= procTableSize) {
+        growProcTable();
+    }
+    while (procTable[currentPID % procTableSize] != NULL) {
         currentPID++;
     }
-    if (i == MAXPROC) {
+
+    // allocate stack before claiming a PCB, so failure leaves no trace
+    int stackClass;
+    int usable = profiledStack(name);
+    void* stackMem = allocStack(stacksize, usable, &stackClass);
+    if (stackMem == NULL) {
+        restoreInterrupts(prevInt);
         return -1;
     }
-    PCB* new = &processes[currentPID % MAXPROC];
+
     // set values in struct for new process
+    PCB* new = allocPCB();
+    new->stackClass = stackClass;
+    new->stackUsable = usable && usable < (1 << stackClass) ? usable : 1 << stackClass;
     new->pid = currentPID++;
     new->priority = priority;
+    new->quantum = quantum;
+    new->tickets = currentProc->tickets; // inherit parent's share
+    new->runPriority = basePriority(new);
     new->isAllocated = 1;
+    insertProc(new);
+    addToGroup(new, currentProc->group->pgid); // children start in their parent's group
     strcpy(new->processName, name);
     new->parent = currentProc;
     if (currentProc->child != NULL) {
@@ -203,13 +548,16 @@ int fork1(char *name, int (*func)(char*), char *arg, int stacksize, int priority
         strcpy(new->arg, arg);
     }
 
-    // allocate stack, initialize context
-    void* stackMem = malloc(stacksize);
+    // initialize context on the new stack; the whole size class is handed
+    // over, so the stack's top is always at the top of its region
     new->stackMem = stackMem;
-    USLOSS_ContextInit(&new->context, stackMem, stacksize, NULL, &trampoline);
+    USLOSS_ContextInit(&new->context, stackMem, 1 << stackClass, NULL, &trampoline);
 
     new->runState = RUNNABLE;
+    new->stateSince = currentTime();
     addToQueue(new);
+    currentProc->stats.childrenForked++;
+    traceEvent(TRACE_FORK, new->pid, currentProc->pid);
 
     dispatch();
     restoreInterrupts(prevInt);
@@ -230,50 +578,49 @@ int join(int *status) {
     checkMode("join");
     int prevInt = disableInterrupts();
     
-    if (currentProc->child == NULL) { return -2; } // current proc. has no unjoined children
-                                                   
-    PCB* currChild = currentProc->child;
-    while (currChild) {
-        if (currChild->runState == DEAD) {
-            *status = currChild->status; // collect status
-
-            // remove child from the linked list
-            if (currChild->prevSibling != NULL){
-                // change left sibling's ptr
-                currChild->prevSibling->nextSibling = currChild->nextSibling;
-            }
-            else {
-                // change parent's child ptr
-                if (currChild->nextSibling != NULL) {
-                    currChild->nextSibling->prevSibling = NULL;
-                }
-                currentProc->child = currChild->nextSibling; 
-            }
+    if (currentProc->child == NULL) { // current proc. has no unjoined children
+        restoreInterrupts(prevInt);
+        return -2;
+    }
 
-            if (currChild->nextSibling != NULL) {
-                // change right sibling's ptr
-                currChild->nextSibling->prevSibling = currChild->prevSibling;
-            } 
-
-            // free up child's stack and empty spot in process table
-            free(currChild->stackMem);
-            currChild->isAllocated = 0;
-            currChild->parent = NULL;
-            currChild->prevSibling = NULL;
-            currChild->nextSibling = NULL;
-            currChild->child = NULL;
-            restoreInterrupts(prevInt);
-            return currChild->pid;
-        }
-        currChild = currChild->nextSibling;
+    // block until at least one child has died
+    while (currentProc->deadHead == NULL) {
+        blockMe(JOINING);
+    }
+
+    // take the most recently forked dead child off the front of the list
+    PCB* currChild = currentProc->deadHead;
+    currentProc->deadHead = currChild->nextDead;
+    if (currentProc->deadHead == NULL) { currentProc->deadTail = NULL; }
+    *status = currChild->status; // collect status
+
+    // remove child from the linked list
+    if (currChild->prevSibling != NULL){
+        // change left sibling's ptr
+        currChild->prevSibling->nextSibling = currChild->nextSibling;
+    }
+    else {
+        // change parent's child ptr
+        currentProc->child = currChild->nextSibling; 
     }
 
-    // no dead children found; block and wait for one to die
-    blockMe(JOINING);
+    if (currChild->nextSibling != NULL) {
+        // change right sibling's ptr
+        currChild->nextSibling->prevSibling = currChild->prevSibling;
+    } 
+
+    // free up child's stack and empty spot in process table
+    int childPid = currChild->pid;
+    traceEvent(TRACE_JOIN, childPid, currentProc->pid);
+    currentProc->stats.childrenReaped++;
+    freeStack(currChild);
+    procTable[childPid % procTableSize] = NULL;
+    liveProcs--;
+    removeFromGroup(currChild);
+    freePCB(currChild);
 
-    // now awakened, recursively call join() to collect status
     restoreInterrupts(prevInt);
-    return join(status);
+    return childPid;
 }
 
 /**
@@ -295,31 +642,73 @@ void quit(int status) {
         USLOSS_Halt(1);
     }
 
+    int now = currentTime();
     currentProc->status = status;
-    currentProc->runState = DEAD;
+    currentProc->stackPeak = stackHighWater(currentProc->stackMem, currentProc->stackClass,
+            currentProc->stackUsable);
+    recordStackPeak(currentProc->processName, currentProc->stackPeak);
+    enterState(currentProc, DEAD, now);
     removeFromQueue(currentProc);
+    traceEvent(TRACE_QUIT, currentProc->pid, status);
 
-    // wake up this process's parent if it is blocked in join()
+    if (currentProc->period) { leaveEdf(currentProc); }
+
+    // anyone still waiting on this process has nobody left to lend priority to
+    while (currentProc->donors) {
+        PCB* donor = currentProc->donors;
+        currentProc->donors = donor->nextDonor;
+        donor->blockedOn = NULL;
+        donor->nextDonor = NULL;
+    }
+
+    // add self to parent's list of dead children
     PCB* parent = currentProc->parent;
+    addToDeadList(parent, currentProc);
+
+    // wake up this process's parent if it is blocked in join()
     if (parent->runState == BLOCKED && parent->blockStatus == JOINING) {
-        parent->runState = RUNNABLE;
+        enterState(parent, RUNNABLE, now);
         parent->blockStatus = UNBLOCKED;
         addToQueue(parent);
+        traceEvent(TRACE_UNBLOCK, parent->pid, currentProc->pid);
     }
 
     // wake up any & all process currently zap()-ing this process
     PCB* cur = currentProc->zappedBy;
     PCB* temp;
     while (cur) {
-        cur->runState = RUNNABLE;
+        enterState(cur, RUNNABLE, now);
         cur->blockStatus = UNBLOCKED;
         addToQueue(cur);
+        traceEvent(TRACE_UNBLOCK, cur->pid, currentProc->pid);
 
         temp = cur->nextZapper;
         cur->nextZapper = NULL;
         cur = temp;
     }
 
+    // count down the group this process was zapped with, waking every
+    // process blocked in zapGroup() on it once the last marked member has quit
+    ProcGroup* zapped = currentProc->zappedWith;
+    if (zapped) {
+        currentProc->zappedWith = NULL;
+        zapped->zapPending--;
+        if (zapped->zapPending == 0) {
+            cur = zapped->zappers;
+            zapped->zappers = NULL;
+            while (cur) {
+                enterState(cur, RUNNABLE, now);
+                cur->blockStatus = UNBLOCKED;
+                addToQueue(cur);
+                traceEvent(TRACE_UNBLOCK, cur->pid, currentProc->pid);
+
+                temp = cur->nextZapper;
+                cur->nextZapper = NULL;
+                cur = temp;
+            }
+        }
+    }
+
     dispatch();
     restoreInterrupts(prevInt);
 }
@@ -341,174 +730,151 @@ int getpid(void) {
 
 /**
  * Purpose:
- * Dumps out information on all running or zombies processes
+ * Returns the position of a process's PCB in the PCB pool. The index stays
+ * the same for as long as the process exists and is always less than
+ * PROC_TABLE_LIMIT, so later phases can use it to index their own
+ * per-process tables
  * 
  * Parameters:
- * None
+ * int pid  PID of process to look up
  *
  * Return:
- * None
+ * int  Index of the process's PCB, or -1 if there is no such process
  */ 
-void dumpProcesses(void) {
-    checkMode("dumpProcesses");
-    int prevInt = disableInterrupts();
-    
-    USLOSS_Console(" PID  PPID  NAME              PRIORITY  STATE\n");
-    for (int i = 0; i < MAXPROC; i++) {
-        if (!processes[i].isAllocated) { continue; }
-
-        PCB* cur = &processes[i];
-
-        USLOSS_Console("%4d  ", cur->pid);
-        if (cur->parent != NULL) { USLOSS_Console("%4d  ", cur->parent->pid); }
-        else { USLOSS_Console("   0  "); }
-        USLOSS_Console("%-16s  ", cur->processName);
-
-        USLOSS_Console("%-8d  ", cur->priority);
-        switch (cur->runState) {
-            case RUNNABLE:
-                USLOSS_Console("Runnable");
-                break;
-            case RUNNING:
-                USLOSS_Console("Running");
-                break;
-            case BLOCKED:
-                USLOSS_Console("Blocked");
-                switch (cur->blockStatus) {
-                    case ZAPPING:
-                        USLOSS_Console("(waiting for zap target to quit)");
-                        break;
-                    case JOINING:
-                        USLOSS_Console("(waiting for child to quit)");
-                        break;
-                    default:
-                        USLOSS_Console("(%d)", cur->blockStatus);
-                }
-                break;
-            case DEAD:
-                USLOSS_Console("Terminated(%d)", cur->status);
-                break;
-        }
-        USLOSS_Console("\n");
-    }
-    restoreInterrupts(prevInt);
+int procIndex(int pid) {
+    checkMode("procIndex");
+    PCB* proc = findProc(pid);
+    return proc ? proc->index : -1;
 }
 
-
-    /* -------- Phase 1b Functions -------- */
-
 /**
  * Purpose:
- * Tells a process that it should quit as soon as possible; similar to UNIX kill
+ * Reserves size bytes of every PCB's extension area for a later phase's
+ * per-process state, in place of a table of its own indexed by pid. The
+ * block is zeroed whenever its PCB is handed to a new process and stays
+ * at the same address for as long as that process exists
  * 
  * Parameters:
- * int pid  Process pid that we want to zap
+ * int size     Bytes the caller needs in each PCB
  *
  * Return:
- * None
+ * int  Handle to pass to procExtension() and myProcExtension(), or -1 if
+ *      size is invalid or the extension area has no room left
  */ 
-void zap(int pid) {
-    checkMode("zap");
-    int prevInt = disableInterrupts();
-
-    // check for invalid pid
-    char err[] = "ERROR: Attempt to zap()";
-    if (pid <= 0) {
-        USLOSS_Console("%s a PID which is <=0.  other_pid = %d\n", err, pid);
-        USLOSS_Halt(1);
-    }
-    if (pid == 1) {
-        USLOSS_Console("%s init.\n", err);
-        USLOSS_Halt(1);
-    }
-    if (pid == currentProc->pid) {
-        USLOSS_Console("%s itself.\n", err);
-        USLOSS_Halt(1);
-    }
-    if (!processes[pid % MAXPROC].isAllocated || processes[pid % MAXPROC].pid != pid) {
-        USLOSS_Console("%s a non-existent process.\n", err);
-        USLOSS_Halt(1);
-    }
-    if (processes[pid % MAXPROC].runState == 3) {
-        USLOSS_Console("%s a process that is already in the process of dying.\n", err);
-        USLOSS_Halt(1);
-    }
-
-    // add self to list of processes currently zap()-ing process pid
-    PCB* toZap = &processes[pid % MAXPROC]; // do this for every ref. to processes?
-    currentProc->nextZapper = toZap->zappedBy;
-    toZap->zappedBy = currentProc;
-
-    // block and call dispatcher
-    blockMe(ZAPPING);
+int registerProcExtension(int size) {
+    checkMode("registerProcExtension");
+    int aligned = (size + sizeof(long long) - 1) & ~(int)(sizeof(long long) - 1);
+    if (size <= 0 || extUsed + aligned > PROC_EXT_SIZE) { return -1; }
+    int handle = extUsed;
+    extUsed += aligned;
+    return handle;
+}
 
-    restoreInterrupts(prevInt);
+/**
+ * Purpose:
+ * Finds a later phase's per-process block in a process's PCB
+ * 
+ * Parameters:
+ * int pid      PID of process
+ * int handle   Handle returned by registerProcExtension()
+ *
+ * Return:
+ * void*    The process's block, or NULL if there is no such process
+ */ 
+void* procExtension(int pid, int handle) {
+    checkMode("procExtension");
+    PCB* proc = findProc(pid);
+    return proc ? (char*)proc->ext + handle : NULL;
 }
 
 /**
  * Purpose:
- * Checks to see if the current process is being zapped
+ * Finds a later phase's per-process block in the current process's PCB,
+ * without the pid lookup procExtension() needs
  * 
  * Parameters:
- * None
+ * int handle   Handle returned by registerProcExtension()
  *
  * Return:
- * int  1 if process is being zapped and 0 otherwise
+ * void*    The current process's block
  */ 
-int isZapped(void) {
-    checkMode("isZapped");
-    return (currentProc->zappedBy != NULL);
+void* myProcExtension(int handle) {
+    checkMode("myProcExtension");
+    return (char*)currentProc->ext + handle;
 }
 
 /**
  * Purpose:
- * Puts the current process into the blocked state
+ * Copies a process's scheduling statistics into stats. Counters are kept
+ * up to date by the dispatcher, blockMe() and the wakeup paths; the time
+ * spent so far in the process's current state is added on here, so a
+ * process that has been waiting or blocked for a long time shows it
  * 
  * Parameters:
- * int blockStatus  Status as to why process is being blocked
+ * int pid          PID of process to report on
+ * ProcStats* stats Where to put the statistics
  *
  * Return:
- * None
+ * int  0 on success, -1 if there is no such process
  */ 
-void blockMe(int blockStatus) {
-    checkMode("blockMe");
+int getProcStats(int pid, ProcStats* stats) {
+    checkMode("getProcStats");
     int prevInt = disableInterrupts();
 
-    if (blockStatus <= 10) {
-        USLOSS_Console("ERROR: invalid block_status\n");
+    PCB* proc = findProc(pid);
+    if (proc == NULL || stats == NULL) {
+        restoreInterrupts(prevInt);
+        return -1;
     }
 
-    currentProc->runState = BLOCKED;
-    currentProc->blockStatus = blockStatus;
-    removeFromQueue(currentProc);
-    dispatch();
+    int now = currentTime();
+    if (proc == currentProc) {
+        chargeMode(proc, now, USLOSS_PsrGet() & USLOSS_PSR_CURRENT_MODE);
+    }
+    *stats = proc->stats;
+    stats->pid = proc->pid;
+    stats->priority = proc->priority;
+    stats->runPriority = proc->runPriority;
+    stats->cpuTime = proc->totalCpuTime;
+    stats->stackSize = 1 << proc->stackClass;
+    stats->stackPeak = proc->runState == DEAD ? proc->stackPeak :
+        stackHighWater(proc->stackMem, proc->stackClass, proc->stackUsable);
+
+    int elapsed = now - proc->stateSince;
+    if (proc->runState == RUNNING) { stats->cpuTime += now - proc->currentStartTime; }
+    if (proc->runState == RUNNABLE) { stats->waitTime += elapsed; }
+    if (proc->runState == BLOCKED) {
+        stats->blockTime += elapsed;
+        stats->blockTimeByStatus[statusSlot(proc->blockStatus)] += elapsed;
+    }
 
     restoreInterrupts(prevInt);
+    return 0;
 }
 
 /**
  * Purpose:
- * Puts a specified process back into the runnable state
+ * Sets the number of tickets a process holds. Under stride scheduling
+ * each process with priority 2-5 gets a share of the CPU proportional to
+ * its tickets. Children inherit their parent's tickets at fork1() time
  * 
  * Parameters:
- * int pid  PID of process to put back into runnable state
+ * int pid      PID of process to set tickets for
+ * int tickets  Number of tickets, must be between 1 and STRIDE1
  *
  * Return:
- * int  0 if there were no issues, -2 if there were any issues with unblocking
+ * int  0 if the tickets were set, -1 if the pid or ticket count is invalid
  */ 
-int unblockProc(int pid) {
-    checkMode("unblockProc");
+int setTickets(int pid, int tickets) {
+    checkMode("setTickets");
     int prevInt = disableInterrupts();
 
-    PCB* proc = &processes[pid % MAXPROC];
-    if (proc == NULL || proc->pid != pid) {
+    PCB* proc = findProc(pid);
+    if (proc == NULL || tickets < 1 || tickets > STRIDE1) {
         restoreInterrupts(prevInt);
-        return -2;
+        return -1;
     }
-    proc->runState = RUNNABLE;
-    proc->blockStatus = UNBLOCKED;
-    addToQueue(proc);
-    dispatch();
+    proc->tickets = tickets;
 
     restoreInterrupts(prevInt);
     return 0;
@@ -516,127 +882,1754 @@ int unblockProc(int pid) {
 
 /**
  * Purpose:
- * Returns the time the current process began on the CPU in milliseconds
+ * Dumps out the share of the CPU each stride scheduled process asked for
+ * (its fraction of all tickets held) next to the share it actually got
+ * (its fraction of the CPU time used by all of them)
  * 
  * Parameters:
  * None
  *
  * Return:
- * int  Time the process started on the system
+ * None
  */ 
-int readCurStartTime(void) {
-    checkMode("readCurStartTime");
-    return currentProc->currentStartTime;
+void dumpShares(void) {
+    checkMode("dumpShares");
+    int prevInt = disableInterrupts();
+
+    long totalTickets = 0;
+    long totalCpu = 0;
+    int now = currentTime();
+    for (int i = 0; i < procTableSize; i++) {
+        PCB* cur = procTable[i];
+        if (cur == NULL || !isStride(cur) || cur->runState == DEAD) { continue; }
+        totalTickets += cur->tickets;
+        totalCpu += cur->totalCpuTime;
+        if (cur == currentProc) { totalCpu += now - cur->currentStartTime; }
+    }
+
+    USLOSS_Console(" PID  NAME              TICKETS  REQUESTED  ACHIEVED  CPU(us)\n");
+    for (int i = 0; i < procTableSize; i++) {
+        PCB* cur = procTable[i];
+        if (cur == NULL || !isStride(cur) || cur->runState == DEAD) { continue; }
+        long cpu = cur->totalCpuTime;
+        if (cur == currentProc) { cpu += now - cur->currentStartTime; }
+        USLOSS_Console("%4d  %-16s  %7d  %8.1f%%  %7.1f%%  %ld\n", cur->pid, cur->processName,
+                cur->tickets, 100.0 * cur->tickets / totalTickets,
+                totalCpu ? 100.0 * cpu / totalCpu : 0.0, cpu);
+    }
+
+    restoreInterrupts(prevInt);
 }
 
 /**
  * Purpose:
- * Returns the total time a process has taken on the CPU in microseconds
+ * Dumps out how each live process's CPU time splits into user, kernel and
+ * interrupt time, followed by the CPU time spent in each kind of handler
+ * over the whole run
  * 
  * Parameters:
  * None
  *
  * Return:
- * int  Total time a process has been on the CPU
+ * None
  */ 
-int readtime(void) {
-    checkMode("readtime");
-    return currentProc->totalCpuTime + (currentTime() - readCurStartTime());
+void dumpCpuModes(void) {
+    checkMode("dumpCpuModes");
+    int prevInt = disableInterrupts();
+    chargeMode(currentProc, currentTime(), 1);
+
+    USLOSS_Console(" PID  NAME                 USER(us)  KERNEL(us)  INTERRUPT(us)\n");
+    for (int i = 0; i < procTableSize; i++) {
+        PCB* cur = procTable[i];
+        if (cur == NULL || cur->runState == DEAD) { continue; }
+        USLOSS_Console("%4d  %-16s  %11d  %10d  %13d\n", cur->pid, cur->processName,
+                cur->stats.userTime, cur->stats.kernelTime, cur->stats.interruptTime);
+    }
+
+    char* names[USLOSS_NUM_INTS] = { "clock", "alarm", "disk", "term", "mmu", "syscall", "illegal" };
+    USLOSS_Console("handler time (us):");
+    for (int i = 0; i < USLOSS_NUM_INTS; i++) {
+        if (intTime[i]) { USLOSS_Console("  %s %lld", names[i], intTime[i]); }
+    }
+    USLOSS_Console("\n");
+
+    restoreInterrupts(prevInt);
 }
 
 /**
  * Purpose:
- * Returns the current time of the system in microseconds
+ * Puts a process in the earliest-deadline-first class, changes its period
+ * and budget, or takes it out of the class again. An EDF process runs ahead
+ * of every fixed priority, EDF processes ordered by deadline, for up to
+ * budget microseconds of CPU each period; past that it runs at its normal
+ * priority until the period ends. The process is only admitted if the
+ * budget/period shares of all EDF processes stay within PHASE1_EDF_UTIL
+ * percent of the CPU
  * 
  * Parameters:
- * None
+ * int pid      PID of process to change
+ * int period   Length of each period in microseconds
+ * int budget   CPU time allowed per period, 0 to leave the EDF class
  *
  * Return:
- * int  Current time of system in microseconds
+ * int  0 on success, -1 if the pid, period or budget is invalid, -2 if
+ *      admitting the process would reserve too much of the CPU
  */ 
-int currentTime(void) {
-    checkMode("currentTime");
+int setRealTime(int pid, int period, int budget) {
+    checkMode("setRealTime");
     int prevInt = disableInterrupts();
 
-    int ret;
+    PCB* proc = findProc(pid);
+    if (proc == NULL || proc->runState == DEAD || proc->priority > 5 || budget < 0 ||
+        (budget > 0 && (period <= 0 || budget > period))) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+
+    int oldShare = proc->period ? edfShare(proc->period, proc->budget) : 0;
+    int newShare = budget ? edfShare(period, budget) : 0;
+    if (edfUtil - oldShare + newShare > edfUtilMax) {
+        restoreInterrupts(prevInt);
+        return -2;
+    }
+
+    if (budget == 0) {
+        if (proc->period) {
+            leaveEdf(proc);
+            setBasePriority(proc, basePriority(proc));
+        }
+    }
+    else {
+        if (proc->period == 0) {
+            proc->nextEdf = edfProcs;
+            edfProcs = proc;
+        }
+        edfUtil += newShare - oldShare;
+        proc->period = period;
+        proc->budget = budget;
+        proc->deadline = currentTime();
+        newPeriod(proc, proc->deadline);
+    }
+
+    // the process may now outrank the caller, or the caller may have
+    // just given up its own place
+    dispatch();
+
+    restoreInterrupts(prevInt);
+    return 0;
+}
+
+/**
+ * Purpose:
+ * Dumps out every process in the EDF class with its period, budget and
+ * current deadline, and how often it has missed a deadline or run out of
+ * budget, followed by the share of the CPU reserved by the class
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void dumpDeadlines(void) {
+    checkMode("dumpDeadlines");
+    int prevInt = disableInterrupts();
+
+    USLOSS_Console(" PID  NAME              PERIOD(us)  BUDGET(us)   SHARE  DEADLINE  MISSES  OVERRUNS\n");
+    for (PCB* cur = edfProcs; cur != NULL; cur = cur->nextEdf) {
+        USLOSS_Console("%4d  %-16s  %10d  %10d  %5.1f%%  %8d  %6d  %8d\n", cur->pid, cur->processName,
+                cur->period, cur->budget, 100.0 * edfShare(cur->period, cur->budget) / PPM,
+                cur->deadline, cur->stats.deadlineMisses, cur->stats.budgetOverruns);
+    }
+    USLOSS_Console("reserved: %.1f%% of %.1f%%\n", 100.0 * edfUtil / PPM, 100.0 * edfUtilMax / PPM);
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Dumps out, for each priority, the configured time slice next to the
+ * lengths of the slices processes actually ran for (until they blocked,
+ * were preempted or used up the quantum), for tuning quantumTable. In
+ * tickless mode also reports how many idle clock ticks were skipped
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void dumpSlices(void) {
+    checkMode("dumpSlices");
+    int prevInt = disableInterrupts();
+
+    USLOSS_Console(" PRI  QUANTUM(us)   SLICES  AVG(us)  MAX(us)  EXPIRED\n");
+    for (int i = 0; i < NUMPRIORITIES; i++) {
+        if (sliceCount[i] == 0) { continue; }
+        USLOSS_Console("%4d  %11d  %7d  %7lld  %7d  %6.1f%%\n", i + 1, quantumTable[i], sliceCount[i],
+                sliceTotal[i] / sliceCount[i], sliceMax[i], 100.0 * sliceExpired[i] / sliceCount[i]);
+    }
+    if (tickless) {
+        USLOSS_Console("idle clock ticks skipped: %lld\n", idleTicks);
+    }
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Dumps out the deepest stack use seen for each process name, next to
+ * the stack size that profile-guided sizing gives new processes of that
+ * name
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void dumpStackProfile(void) {
+    checkMode("dumpStackProfile");
+    int prevInt = disableInterrupts();
+
+    USLOSS_Console(" NAME              SAMPLES  PEAK(bytes)  SIZED(bytes)\n");
+    for (int i = 0; i < PROFILE_BUCKETS; i++) {
+        for (StackProfile* profile = stackProfiles[i]; profile != NULL; profile = profile->next) {
+            USLOSS_Console(" %-16s  %7d  %11d  %12d\n", profile->name, profile->samples,
+                    profile->peak, profiledSize(profile));
+        }
+    }
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Dumps out information on all running or zombies processes
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void dumpProcesses(void) {
+    checkMode("dumpProcesses");
+    int prevInt = disableInterrupts();
+    
+    USLOSS_Console(" PID  PPID  NAME              PRIORITY  STATE\n");
+    for (int i = 0; i < procTableSize; i++) {
+        if (procTable[i] == NULL) { continue; }
+
+        PCB* cur = procTable[i];
+
+        USLOSS_Console("%4d  ", cur->pid);
+        if (cur->parent != NULL) { USLOSS_Console("%4d  ", cur->parent->pid); }
+        else { USLOSS_Console("   0  "); }
+        USLOSS_Console("%-16s  ", cur->processName);
+
+        USLOSS_Console("%-8d  ", cur->priority);
+        switch (cur->runState) {
+            case RUNNABLE:
+                USLOSS_Console("Runnable");
+                break;
+            case RUNNING:
+                USLOSS_Console("Running");
+                break;
+            case BLOCKED:
+                USLOSS_Console("Blocked");
+                switch (cur->blockStatus) {
+                    case ZAPPING:
+                        USLOSS_Console("(waiting for zap target to quit)");
+                        break;
+                    case JOINING:
+                        USLOSS_Console("(waiting for child to quit)");
+                        break;
+                    default:
+                        USLOSS_Console("(%d)", cur->blockStatus);
+                }
+                break;
+            case DEAD:
+                USLOSS_Console("Terminated(%d)", cur->status);
+                break;
+        }
+        USLOSS_Console("\n");
+    }
+    restoreInterrupts(prevInt);
+}
+
+
+    /* -------- Phase 1b Functions -------- */
+
+/**
+ * Purpose:
+ * Tells a process that it should quit as soon as possible; similar to UNIX kill
+ * 
+ * Parameters:
+ * int pid  Process pid that we want to zap
+ *
+ * Return:
+ * None
+ */ 
+void zap(int pid) {
+    checkMode("zap");
+    int prevInt = disableInterrupts();
+
+    // check for invalid pid
+    char err[] = "ERROR: Attempt to zap()";
+    if (pid <= 0) {
+        USLOSS_Console("%s a PID which is <=0.  other_pid = %d\n", err, pid);
+        USLOSS_Halt(1);
+    }
+    if (pid == 1) {
+        USLOSS_Console("%s init.\n", err);
+        USLOSS_Halt(1);
+    }
+    if (pid == currentProc->pid) {
+        USLOSS_Console("%s itself.\n", err);
+        USLOSS_Halt(1);
+    }
+    PCB* toZap = findProc(pid);
+    if (toZap == NULL) {
+        USLOSS_Console("%s a non-existent process.\n", err);
+        USLOSS_Halt(1);
+    }
+    if (toZap->runState == DEAD) {
+        USLOSS_Console("%s a process that is already in the process of dying.\n", err);
+        USLOSS_Halt(1);
+    }
+
+    // add self to list of processes currently zap()-ing process pid
+    currentProc->nextZapper = toZap->zappedBy;
+    toZap->zappedBy = currentProc;
+    traceEvent(TRACE_ZAP, pid, currentProc->pid);
+
+    // block and call dispatcher
+    blockMe(ZAPPING);
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Checks to see if the current process is being zapped
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * int  1 if process is being zapped and 0 otherwise
+ */ 
+int isZapped(void) {
+    checkMode("isZapped");
+    return (currentProc->zappedBy != NULL || currentProc->zappedWith != NULL);
+}
+
+/**
+ * Purpose:
+ * Returns the process group a process belongs to
+ * 
+ * Parameters:
+ * int pid  PID of process to look up
+ *
+ * Return:
+ * int  Process group ID, or -1 if there is no such process
+ */ 
+int getProcGroup(int pid) {
+    checkMode("getProcGroup");
+    PCB* proc = findProc(pid);
+    return proc ? proc->group->pgid : -1;
+}
+
+/**
+ * Purpose:
+ * Moves a process into a process group. Processes start out in their
+ * parent's group; a group ID of 0 starts a new group, named after the
+ * process, with the process as its only member
+ * 
+ * Parameters:
+ * int pid      PID of process to move
+ * int pgid     Group to move it to: an existing group, the process's own
+ *              PID, or 0 for the process's own PID
+ *
+ * Return:
+ * int  0 if there were no issues, -1 if there is no such process or group,
+ *      or the process is being zapped along with its current group
+ */ 
+int setProcGroup(int pid, int pgid) {
+    checkMode("setProcGroup");
+    int prevInt = disableInterrupts();
+
+    PCB* proc = findProc(pid);
+    if (pgid == 0) { pgid = pid; }
+    if (proc == NULL || (pgid != pid && findGroup(pgid) == NULL) || proc->zappedWith) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+
+    removeFromGroup(proc);
+    addToGroup(proc, pgid);
+
+    restoreInterrupts(prevInt);
+    return 0;
+}
+
+/**
+ * Purpose:
+ * Zaps every member of a process group in one pass, then blocks once
+ * until all of them have quit. Members that have already quit, the caller
+ * and its ancestors (which may be blocked in join() waiting on the caller)
+ * are skipped. Members another zapGroup() has already marked are waited
+ * for too, so every caller returns only once the whole group is gone
+ * 
+ * Parameters:
+ * int pgid     Process group to zap
+ *
+ * Return:
+ * int  Number of processes waited for, or -1 if there is no such group
+ */ 
+int zapGroup(int pgid) {
+    checkMode("zapGroup");
+    int prevInt = disableInterrupts();
+
+    ProcGroup* group = findGroup(pgid);
+    if (group == NULL) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+
+    int zapped = 0;
+    for (PCB* cur = group->head; cur != NULL; cur = cur->nextInGroup) {
+        if (cur->runState == DEAD || isAncestor(cur, currentProc)) {
+            continue;
+        }
+        if (!cur->zappedWith) {
+            cur->zappedWith = group;
+            group->zapPending++;
+            traceEvent(TRACE_ZAP, cur->pid, currentProc->pid);
+        }
+        zapped++;
+    }
+
+    // the group may be reaped, and freed, while this process is blocked,
+    // so look it up again after every wakeup
+    while (group != NULL && group->zapPending > 0) {
+        currentProc->nextZapper = group->zappers;
+        group->zappers = currentProc;
+        blockMe(ZAPPING);
+        group = findGroup(pgid);
+    }
+
+    restoreInterrupts(prevInt);
+    return zapped;
+}
+
+/**
+ * Purpose:
+ * Puts the current process into the blocked state
+ * 
+ * Parameters:
+ * int blockStatus  Status as to why process is being blocked
+ *
+ * Return:
+ * None
+ */ 
+void blockMe(int blockStatus) {
+    checkMode("blockMe");
+    int prevInt = disableInterrupts();
+
+    if (blockStatus <= 10) {
+        USLOSS_Console("ERROR: invalid block_status\n");
+    }
+    if (inKernelTask) {
+        USLOSS_Console("ERROR: a kernel task tried to block\n");
+        USLOSS_Halt(1);
+    }
+
+    // MLFQ: a process that gives up the CPU before its quantum is used
+    // moves back up a level, but never above the priority it was forked at
+    int now = currentTime();
+    if (schedMode == SCHED_MLFQ && blockStatus != JOINING && blockStatus != ZAPPING &&
+        !currentProc->boostedFrom && currentProc->runPriority > currentProc->priority &&
+        !sliceUsedUp(currentProc, now)) {
+        currentProc->runPriority--;
+    }
+
+    enterState(currentProc, BLOCKED, now);
+    currentProc->blockStatus = blockStatus;
+    removeFromQueue(currentProc);
+    traceEvent(TRACE_BLOCK, currentProc->pid, blockStatus);
+    dispatch();
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Puts the current process into the blocked state and switches directly to
+ * another process, giving it whatever is left of the current time slice.
+ * Used for synchronous IPC, where the process that just woke a receiver is
+ * about to block waiting for its reply. The handoff only happens if the
+ * target is runnable and nothing of higher priority is ready; otherwise
+ * this is the same as blockMe()
+ * 
+ * Parameters:
+ * int blockStatus  Status as to why process is being blocked
+ * int pid          PID of process to hand the CPU to
+ *
+ * Return:
+ * None
+ */ 
+void blockMeHandoff(int blockStatus, int pid) {
+    checkMode("blockMeHandoff");
+    int prevInt = disableInterrupts();
+
+    PCB* target = findProc(pid);
+    if (target != NULL && target->runState == RUNNABLE) {
+        handoffTo = target;
+    }
+    blockMe(blockStatus);
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Gives up the CPU without blocking: the current process goes to the back
+ * of its run queue and, if the named process is runnable and nothing of
+ * higher priority is ready, switches straight to it, giving it whatever is
+ * left of the current time slice. Lets processes at the same priority that
+ * feed each other take turns without waiting out a quantum
+ * 
+ * Parameters:
+ * int pid  PID of process to run next, or 0 to just yield
+ *
+ * Return:
+ * int  0 if the CPU was offered to pid (or pid was 0), 1 if pid was not
+ *      runnable so this was a plain yield, -1 if there is no such process
+ */ 
+int yieldTo(int pid) {
+    checkMode("yieldTo");
+    int prevInt = disableInterrupts();
+
+    PCB* target = pid ? findProc(pid) : NULL;
+    if (pid && target == NULL) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+    int runnable = target == NULL || target->runState == RUNNABLE;
+    if (target != NULL && runnable) {
+        handoffTo = target;
+    }
+    yielding = 1;
+    dispatch();
+
+    restoreInterrupts(prevInt);
+    return runnable ? 0 : 1;
+}
+
+/**
+ * Purpose:
+ * Puts the current process into the blocked state waiting on a resource
+ * held by another process. Until the waiter is unblocked the owner runs at
+ * no worse than the waiter's priority (priority inheritance), so a low
+ * priority owner cannot keep a high priority waiter blocked while medium
+ * priority work runs. Chains of owners that are themselves blocked on
+ * other owners are boosted all the way along. Turned off by setting the
+ * PHASE1_INHERIT kernel parameter to 0, in which case this is blockMe()
+ * 
+ * Parameters:
+ * int blockStatus  Status as to why process is being blocked
+ * int ownerPid     PID of process holding what the current process waits for
+ *
+ * Return:
+ * None
+ */ 
+void blockMeOn(int blockStatus, int ownerPid) {
+    checkMode("blockMeOn");
+    int prevInt = disableInterrupts();
+
+    PCB* owner = findProc(ownerPid);
+    if (inheritPriority && owner != NULL && owner != currentProc && owner->runState != DEAD) {
+        attachDonor(currentProc, owner);
+    }
+    blockMe(blockStatus);
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Changes which process a blocked process is waiting on, moving its
+ * priority donation with it. Used when a resource is handed from one
+ * owner to the next while other waiters stay blocked. Takes effect at the
+ * next dispatch
+ * 
+ * Parameters:
+ * int pid          PID of blocked process
+ * int ownerPid     PID of its new owner, or 0 for none
+ *
+ * Return:
+ * int  0 if there were no issues, -1 if pid is not a blocked process
+ */ 
+int setWaitOwner(int pid, int ownerPid) {
+    checkMode("setWaitOwner");
+    int prevInt = disableInterrupts();
+
+    PCB* proc = findProc(pid);
+    if (proc == NULL || proc->runState != BLOCKED) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+
+    if (proc->blockedOn) { detachDonor(proc); }
+    PCB* owner = ownerPid ? findProc(ownerPid) : NULL;
+    if (inheritPriority && owner != NULL && owner != proc && owner->runState != DEAD) {
+        attachDonor(proc, owner);
+    }
+
+    restoreInterrupts(prevInt);
+    return 0;
+}
+
+/**
+ * Purpose:
+ * Puts a specified process back into the runnable state
+ * 
+ * Parameters:
+ * int pid  PID of process to put back into runnable state
+ *
+ * Return:
+ * int  0 if there were no issues, -2 if there were any issues with unblocking
+ */ 
+int unblockProc(int pid) {
+    checkMode("unblockProc");
+    int prevInt = disableInterrupts();
+
+    PCB* proc = findProc(pid);
+    if (proc == NULL) {
+        restoreInterrupts(prevInt);
+        return -2;
+    }
+    if (proc->blockedOn) { detachDonor(proc); }
+    enterState(proc, RUNNABLE, currentTime());
+    proc->blockStatus = UNBLOCKED;
+    addToQueue(proc);
+    traceEvent(TRACE_UNBLOCK, pid, currentProc->pid);
+
+    // if the caller is inside its own critical section (or an interrupt
+    // handler), hold the dispatch until it re-enables interrupts, so a
+    // loop of wakeups costs one scheduling pass instead of one each. A
+    // kernel task must run to completion, so its wakeups always wait
+    if ((deferWakeups && !prevInt) || inKernelTask) {
+        needResched = 1;
+    }
+    else {
+        dispatch();
+    }
+
+    restoreInterrupts(prevInt);
+    return 0;
+}
+
+/**
+ * Purpose:
+ * Runs any pending kernel tasks, then the dispatcher if a wakeup was
+ * deferred by unblockProc(). Later phases call this when they re-enable
+ * interrupts and at the end of their interrupt handlers. Inside a kernel
+ * task it does nothing; the task runner dispatches once the tasks are done
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void reschedule(void) {
+    checkMode("reschedule");
+    if (inKernelTask) { return; }
+    runKernelTasks();
+    if (needResched) {
+        dispatch();
+    }
+}
+
+/**
+ * Purpose:
+ * Queues a kernel task: a callback that runs to completion, in kernel mode
+ * with interrupts off, on the kernel task stack, before the dispatcher
+ * next runs. Interrupt handlers use this to do driver
+ * work without waking a driver process. A task may wake processes and use
+ * the non-blocking mailbox calls, but must never block
+ * 
+ * Parameters:
+ * void (*func)(int, int)   Task to run
+ * int arg1                 First argument for func
+ * int arg2                 Second argument for func
+ *
+ * Return:
+ * int  0 if the task was queued, -1 if the queue is full
+ */ 
+int queueKernelTask(void (*func)(int, int), int arg1, int arg2) {
+    checkMode("queueKernelTask");
+    int prevInt = disableInterrupts();
+
+    if (taskCount == TASK_QUEUE_SIZE) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+    KernelTask* task = &taskQueue[(taskHead + taskCount) % TASK_QUEUE_SIZE];
+    task->func = func;
+    task->arg1 = arg1;
+    task->arg2 = arg2;
+    taskCount++;
+
+    restoreInterrupts(prevInt);
+    return 0;
+}
+
+/**
+ * Purpose:
+ * Asks for the clock handler to run at the first clock interrupt at or after
+ * time. In tickless mode clock interrupts that arrive while only the
+ * sentinel can run are ignored, so later phases call this for every
+ * deadline they need the clock for (the next clock mailbox message, a
+ * sleeper's wakeup)
+ * 
+ * Parameters:
+ * int time     Time the clock handler is needed by, in microseconds
+ *
+ * Return:
+ * None
+ */ 
+void requestTick(int time) {
+    checkMode("requestTick");
+    if (time < nextTick) {
+        nextTick = time;
+    }
+}
+
+/**
+ * Purpose:
+ * Marks the start of a system call or interrupt handler, so the CPU time
+ * the current process spends in it is charged as kernel or interrupt time
+ * rather than to the code it interrupted. Must be called on entry to the
+ * handler, before the PSR is changed
+ * 
+ * Parameters:
+ * int mode     CPU_KERNEL for a system call, CPU_INTERRUPT for a device
+ * int intType  Interrupt being handled (USLOSS_SYSCALL_INT for a system call)
+ *
+ * Return:
+ * int  Token to pass to leaveCpuMode() when the handler returns
+ */ 
+int enterCpuMode(int mode, int intType) {
+    checkMode("enterCpuMode");
+    int interruptedKernel = USLOSS_PsrGet() & USLOSS_PSR_PREV_MODE;
+    int prevInt = disableInterrupts();
+
+    int token = MODE_TOKEN(currentProc->cpuMode, currentProc->cpuIntType);
+    chargeMode(currentProc, currentTime(), interruptedKernel);
+    currentProc->cpuMode = mode;
+    currentProc->cpuIntType = intType;
+
+    restoreInterrupts(prevInt);
+    return token;
+}
+
+/**
+ * Purpose:
+ * Marks the end of a handler started with enterCpuMode(), going back to
+ * charging whatever the process was doing before it
+ * 
+ * Parameters:
+ * int token    Value enterCpuMode() returned
+ *
+ * Return:
+ * None
+ */ 
+void leaveCpuMode(int token) {
+    checkMode("leaveCpuMode");
+    int prevInt = disableInterrupts();
+
+    chargeMode(currentProc, currentTime(), 1);
+    currentProc->cpuMode = token & 3;
+    currentProc->cpuIntType = token >> 2;
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Returns how much CPU time every process together has spent handling an
+ * interrupt type, or all of them
+ * 
+ * Parameters:
+ * int intType  Interrupt type (USLOSS_SYSCALL_INT for system calls), or -1
+ *              for the total over every type
+ *
+ * Return:
+ * long long    Microseconds, or -1 if intType is invalid
+ */ 
+long long interruptTime(int intType) {
+    checkMode("interruptTime");
+    if (intType < -1 || intType >= USLOSS_NUM_INTS) { return -1; }
+    if (intType >= 0) { return intTime[intType]; }
+
+    long long total = 0;
+    for (int i = 0; i < USLOSS_NUM_INTS; i++) {
+        total += intTime[i];
+    }
+    return total;
+}
+
+/**
+ * Purpose:
+ * Returns the time the current process began on the CPU in milliseconds
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * int  Time the process started on the system
+ */ 
+int readCurStartTime(void) {
+    checkMode("readCurStartTime");
+    return currentProc->currentStartTime;
+}
+
+/**
+ * Purpose:
+ * Returns the total time a process has taken on the CPU in microseconds
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * int  Total time a process has been on the CPU
+ */ 
+int readtime(void) {
+    checkMode("readtime");
+    return currentProc->totalCpuTime + (currentTime() - readCurStartTime());
+}
+
+/**
+ * Purpose:
+ * Returns the current time of the system in microseconds
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * int  Current time of system in microseconds
+ */ 
+int currentTime(void) {
+    checkMode("currentTime");
+    int prevInt = disableInterrupts();
+
+    int ret;
     USLOSS_DeviceInput(USLOSS_CLOCK_DEV, 0, &ret);
 
-    restoreInterrupts(prevInt);
-    return ret;
+    restoreInterrupts(prevInt);
+    return ret;
+}
+
+/**
+ * Purpose:
+ * Responsible for checking if the current processes time slice has expired.
+ * If time slice expired, calls the dispatcher
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void timeSlice(void) {
+    checkMode("timeSlice");
+    int prevInt = disableInterrupts();
+
+    if (sliceUsedUp(currentProc, currentTime())) {
+        dispatch();
+    }
+
+    restoreInterrupts(prevInt);
+}
+
+
+    /* ---------- Helper Functions ---------- */
+
+/**
+ * Purpose:
+ * Checks the current mode of the operating system, halts if user mode attempts to
+ * execute kernel functions
+ * 
+ * Parameters:
+ * char* fnName     Name of function that user mode process attempted to execute
+ *
+ * Return:
+ * None
+ */ 
+void checkMode(char* fnName) {
+    if (!(USLOSS_PsrGet() & USLOSS_PSR_CURRENT_MODE)) {
+        USLOSS_Console("ERROR: Someone attempted to call %s while in user mode!\n",
+                fnName);
+        USLOSS_Halt(1);
+    }
+}
+
+/**
+ * Purpose:
+ * Disables interrupts for when executing kernel mode functions
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * int  State that interrupts were in before function call
+ */ 
+int disableInterrupts() {
+    int prevInt = USLOSS_PsrGet() & USLOSS_PSR_CURRENT_INT; // previous interrupt status
+    USLOSS_PsrSet(prevInt & ~USLOSS_PSR_CURRENT_INT);
+    return prevInt;
+}
+
+/**
+ * Purpose:
+ * Restores interrupts after kernel function has finished executing
+ * 
+ * Parameters:
+ * int prevInt  State that interrupts were in before function call
+ *
+ * Return:
+ * None
+ */ 
+void restoreInterrupts(int prevInt) {
+    // run any dispatch deferred while interrupts were off
+    if (prevInt && needResched) {
+        dispatch();
+    }
+    USLOSS_PsrSet(USLOSS_PsrGet() | prevInt);
+}
+
+/**
+ * Purpose:
+ * Reads an integer kernel parameter from the environment, so features can
+ * be configured at boot without recompiling
+ * 
+ * Parameters:
+ * char* name           Name of the environment variable holding the parameter
+ * int defaultValue     Value to use if the parameter is not set
+ *
+ * Return:
+ * int  Value of the parameter
+ */ 
+int kernelParam(char* name, int defaultValue) {
+    char* value = getenv(name);
+    return value ? atoi(value) : defaultValue;
+}
+
+/**
+ * Purpose:
+ * Checks if a process is scheduled by stride scheduling. In SCHED_STRIDE
+ * mode that is every process with priority 2-5 outside the EDF class; the
+ * priority 1 device daemons still run ahead of them and init and the
+ * sentinel behind them
+ * 
+ * Parameters:
+ * PCB* proc    Process to check
+ *
+ * Return:
+ * int  1 if the process is stride scheduled, 0 otherwise
+ */ 
+int isStride(PCB* proc) {
+    return schedMode == SCHED_STRIDE && proc->priority >= 2 && proc->priority <= 5 && !proc->period;
+}
+
+/**
+ * Purpose:
+ * Checks if a process is running in the EDF class, that is, it is in the
+ * class and has budget left in the current period
+ * 
+ * Parameters:
+ * PCB* proc    Process to check
+ *
+ * Return:
+ * int  1 if the process is scheduled by deadline, 0 otherwise
+ */ 
+int isEdf(PCB* proc) {
+    return proc->period && proc->runPriority == EDF_PRIORITY;
+}
+
+/**
+ * Purpose:
+ * Returns the share of the CPU a period and budget reserve, rounded up so
+ * admission control never lets the total creep past its limit
+ * 
+ * Parameters:
+ * int period   EDF period in microseconds
+ * int budget   CPU time per period in microseconds
+ *
+ * Return:
+ * int  Share of the CPU in parts per million
+ */ 
+int edfShare(int period, int budget) {
+    return (int)(((long long)budget * PPM + period - 1) / period);
+}
+
+/**
+ * Purpose:
+ * Returns the run priority a process has when nothing raises it: the
+ * shared stride queue for stride scheduled processes, otherwise the
+ * priority it was forked at
+ * 
+ * Parameters:
+ * PCB* proc    Process to check
+ *
+ * Return:
+ * int  Natural run priority of the process
+ */ 
+int basePriority(PCB* proc) {
+    return isStride(proc) ? STRIDE_PRIORITY : proc->priority;
+}
+
+/**
+ * Purpose:
+ * Adds time a process just spent on the CPU to its total, and for stride
+ * scheduled processes advances its pass by its stride for every time slice
+ * worth of CPU used. EDF processes spend their budget, dropping to their
+ * normal priority when it runs out
+ * 
+ * Parameters:
+ * PCB* proc    Process to charge
+ * int cpuTime  Microseconds of CPU time to charge
+ *
+ * Return:
+ * None
+ */ 
+void chargeCpu(PCB* proc, int cpuTime) {
+    proc->totalCpuTime = proc->totalCpuTime + cpuTime;
+    if (isStride(proc)) {
+        proc->pass += (long long)cpuTime * (STRIDE1 / proc->tickets) / MAX_TIME_SLICE;
+    }
+    if (isEdf(proc)) {
+        proc->budgetLeft -= cpuTime;
+        if (proc->budgetLeft <= 0) {
+            // out of budget: run at its normal priority until the period ends
+            proc->stats.budgetOverruns++;
+            setBasePriority(proc, basePriority(proc));
+        }
+    }
+}
+
+/**
+ * Purpose:
+ * Charges the time a process has spent in its current cpuMode, since
+ * modeSince, as user, kernel or interrupt time, and starts a new stretch
+ * in the same mode. Handler time also goes into the system wide intTime
+ * totals
+ * 
+ * Parameters:
+ * PCB* proc    Process to charge, must be the one on the CPU
+ * int now      Current time
+ * int kernel   Whether a CPU_BASE stretch was spent in kernel mode
+ *
+ * Return:
+ * None
+ */ 
+void chargeMode(PCB* proc, int now, int kernel) {
+    int elapsed = now - proc->modeSince;
+    proc->modeSince = now;
+    if (proc->cpuMode == CPU_INTERRUPT) { proc->stats.interruptTime += elapsed; }
+    else if (proc->cpuMode == CPU_KERNEL || kernel) { proc->stats.kernelTime += elapsed; }
+    else { proc->stats.userTime += elapsed; }
+
+    if (proc->cpuMode != CPU_BASE) { intTime[(int)proc->cpuIntType] += elapsed; }
+}
+
+/**
+ * Purpose:
+ * Moves a process to a new runState, adding the time it spent in the state
+ * it is leaving to its wait or block time. Time spent running is charged
+ * separately by chargeCpu(). Must be called before blockStatus is cleared
+ * on a wakeup, so the block time goes to the right status, and before the
+ * process is put on a run queue, so a new EDF period can set its priority
+ * 
+ * Parameters:
+ * PCB* proc    Process changing state
+ * int runState State the process is entering
+ * int now      Current time
+ *
+ * Return:
+ * None
+ */ 
+void enterState(PCB* proc, int runState, int now) {
+    // an EDF process waking after its deadline starts a fresh period
+    if (proc->period && proc->runState == BLOCKED && runState == RUNNABLE && now >= proc->deadline) {
+        newPeriod(proc, now);
+    }
+
+    int elapsed = now - proc->stateSince;
+    if (proc->runState == RUNNABLE) { proc->stats.waitTime += elapsed; }
+    if (proc->runState == BLOCKED) {
+        proc->stats.blockTime += elapsed;
+        proc->stats.blockTimeByStatus[statusSlot(proc->blockStatus)] += elapsed;
+    }
+    proc->runState = runState;
+    proc->stateSince = now;
+}
+
+/**
+ * Purpose:
+ * Returns the entry of ProcStats.blockTimeByStatus a block status is
+ * counted in
+ * 
+ * Parameters:
+ * int blockStatus  Block status
+ *
+ * Return:
+ * int  Index into blockTimeByStatus
+ */ 
+int statusSlot(int blockStatus) {
+    if (blockStatus < 0) { return 0; }
+    return blockStatus < MAX_BLOCK_STATUS ? blockStatus : MAX_BLOCK_STATUS - 1;
+}
+
+/**
+ * Purpose:
+ * Records that a blocked process is waiting on an owner and raises the
+ * owner's priority to match if needed
+ * 
+ * Parameters:
+ * PCB* donor   Process that is waiting
+ * PCB* owner   Process it is waiting on
+ *
+ * Return:
+ * None
+ */ 
+void attachDonor(PCB* donor, PCB* owner) {
+    donor->blockedOn = owner;
+    donor->nextDonor = owner->donors;
+    owner->donors = donor;
+    updateBoost(owner);
+}
+
+/**
+ * Purpose:
+ * Takes a process off its owner's list of donors and lowers the owner's
+ * priority again if the process was what it had been boosted to
+ * 
+ * Parameters:
+ * PCB* donor   Process that is no longer waiting
+ *
+ * Return:
+ * None
+ */ 
+void detachDonor(PCB* donor) {
+    PCB* owner = donor->blockedOn;
+    PCB** link = &owner->donors;
+    while (*link != donor) {
+        link = &(*link)->nextDonor;
+    }
+    *link = donor->nextDonor;
+    donor->blockedOn = NULL;
+    donor->nextDonor = NULL;
+    updateBoost(owner);
+}
+
+/**
+ * Purpose:
+ * Sets a process's runPriority to the best of its own and its donors',
+ * then does the same for whoever it is blocked on in turn, since their
+ * donors' priorities may have just changed. Boosts and their undoing are
+ * recorded in the trace
+ * 
+ * Parameters:
+ * PCB* proc    Process whose donors changed
+ *
+ * Return:
+ * None
+ */ 
+void updateBoost(PCB* proc) {
+    // a cycle of owners is a deadlock, but don't loop forever on one
+    for (int hops = 0; proc != NULL && hops < liveProcs; hops++) {
+        // an inherited priority replaces any aging
+        if (proc->agedFrom) {
+            setRunPriority(proc, proc->agedFrom);
+            proc->agedFrom = 0;
+        }
+        int base = proc->boostedFrom ? proc->boostedFrom : proc->runPriority;
+        int best = base;
+        for (PCB* donor = proc->donors; donor != NULL; donor = donor->nextDonor) {
+            // EDF donors lend the best fixed priority, not a place in the EDF queue
+            int lent = donor->runPriority > EDF_PRIORITY ? donor->runPriority : 1;
+            if (lent < best) { best = lent; }
+        }
+        if (best == proc->runPriority) { return; }
+
+        traceEvent(best < proc->runPriority ? TRACE_BOOST : TRACE_UNBOOST, proc->pid, best);
+        setRunPriority(proc, best);
+        proc->boostedFrom = best < base ? base : 0;
+        proc = proc->blockedOn;
+    }
+}
+
+/**
+ * Purpose:
+ * Changes the priority a process is scheduled at, moving it to the right
+ * run queue if it is on one
+ * 
+ * Parameters:
+ * PCB* proc    Process to change
+ * int priority New runPriority
+ *
+ * Return:
+ * None
+ */ 
+void setRunPriority(PCB* proc, int priority) {
+    int queued = proc->runState == RUNNABLE;
+    if (queued) { removeFromQueue(proc); }
+    proc->runPriority = priority;
+    if (queued) { addToQueue(proc); }
+}
+
+/**
+ * Purpose:
+ * Moves a process to a new natural run priority, dropping any aging and
+ * then re-applying whatever priority its donors lend it
+ * 
+ * Parameters:
+ * PCB* proc    Process to change
+ * int base     New natural runPriority
+ *
+ * Return:
+ * None
+ */ 
+void setBasePriority(PCB* proc, int base) {
+    proc->agedFrom = 0;
+    proc->boostedFrom = 0;
+    setRunPriority(proc, base);
+    updateBoost(proc);
+}
+
+/**
+ * Purpose:
+ * Starts a new EDF period for a process: moves its deadline to the end of
+ * the first period that has not finished yet, refills its budget and puts
+ * it back in the EDF queue
+ * 
+ * Parameters:
+ * PCB* proc    EDF process
+ * int now      Current time
+ *
+ * Return:
+ * None
+ */ 
+void newPeriod(PCB* proc, int now) {
+    if (now >= proc->deadline) {
+        proc->deadline += ((now - proc->deadline) / proc->period + 1) * proc->period;
+    }
+    proc->budgetLeft = proc->budget;
+    setBasePriority(proc, EDF_PRIORITY);
+}
+
+/**
+ * Purpose:
+ * Takes a process out of the EDF class and gives back its share of the
+ * CPU. Its run priority is left for the caller to settle
+ * 
+ * Parameters:
+ * PCB* proc    EDF process
+ *
+ * Return:
+ * None
+ */ 
+void leaveEdf(PCB* proc) {
+    PCB** link = &edfProcs;
+    while (*link != proc) {
+        link = &(*link)->nextEdf;
+    }
+    *link = proc->nextEdf;
+    proc->nextEdf = NULL;
+    edfUtil -= edfShare(proc->period, proc->budget);
+    proc->period = 0;
+}
+
+/**
+ * Purpose:
+ * Ends the period of every EDF process whose deadline has passed. One that
+ * is still runnable at its deadline did not finish that period's work in
+ * time, which counts as a deadline miss. Blocked processes are left for
+ * enterState() to start a new period when they wake. Called from the clock
+ * interrupt
+ * 
+ * Parameters:
+ * int now  Current time
+ *
+ * Return:
+ * None
+ */ 
+void edfTick(int now) {
+    for (PCB* proc = edfProcs; proc != NULL; proc = proc->nextEdf) {
+        if (proc->runState == BLOCKED || now < proc->deadline) { continue; }
+
+        proc->stats.deadlineMisses++;
+        if (proc == currentProc) {
+            // settle the old period's budget before refilling it
+            chargeCpu(proc, now - proc->currentStartTime);
+            proc->currentStartTime = now;
+            proc->sliceStart = now;
+        }
+        newPeriod(proc, now);
+        needResched = 1;
+    }
+}
+
+/**
+ * Purpose:
+ * Returns the length of a process's time slice: what is left of its budget
+ * if it is in the EDF class, its own quantum if it was forked with one,
+ * otherwise the quantumTable entry for the priority it is running at. In
+ * MLFQ mode the table defaults to longer quanta for the lower levels where
+ * CPU bound work ends up; otherwise every entry defaults to MAX_TIME_SLICE
+ * 
+ * Parameters:
+ * PCB* proc    Process to find the time slice of
+ *
+ * Return:
+ * int  Length of the time slice in microseconds
+ */ 
+int quantumFor(PCB* proc) {
+    if (isEdf(proc)) {
+        // budgetLeft was last settled at currentStartTime, which a
+        // handoff can leave later than sliceStart
+        return proc->budgetLeft + proc->currentStartTime - proc->sliceStart;
+    }
+    if (proc->quantum) {
+        return proc->quantum;
+    }
+    return quantumTable[proc->runPriority - 1];
+}
+
+/**
+ * Purpose:
+ * Decides whether a process has run its whole time slice. timeSlice(),
+ * the dispatcher and MLFQ all go by this, so a slice that runs exactly
+ * its quantum counts as expired everywhere
+ * 
+ * Parameters:
+ * PCB* proc    Process to check
+ * int now      Current time
+ *
+ * Return:
+ * int  1 if the time slice is used up, 0 otherwise
+ */ 
+int sliceUsedUp(PCB* proc, int now) {
+    return now - proc->sliceStart >= quantumFor(proc);
+}
+
+/**
+ * Purpose:
+ * Takes an unused PCB off the pool's free list, adding another chunk of
+ * PCBs to the pool first if the list is empty
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * PCB*     Zeroed PCB ready to be filled in
+ */ 
+PCB* allocPCB() {
+    if (freePCBs == NULL) {
+        PCB* chunk = calloc(PCB_CHUNK, sizeof(PCB));
+        pcbChunks[pcbPoolSize / PCB_CHUNK] = chunk;
+        for (int i = PCB_CHUNK - 1; i >= 0; i--) {
+            chunk[i].index = pcbPoolSize + i;
+            chunk[i].nextFree = freePCBs;
+            freePCBs = &chunk[i];
+        }
+        pcbPoolSize += PCB_CHUNK;
+    }
+
+    PCB* proc = freePCBs;
+    freePCBs = proc->nextFree;
+
+    int index = proc->index;
+    memset(proc, 0, sizeof(PCB));
+    proc->index = index;
+    return proc;
+}
+
+/**
+ * Purpose:
+ * Returns a PCB to the pool's free list
+ * 
+ * Parameters:
+ * PCB* proc    PCB to release
+ *
+ * Return:
+ * None
+ */ 
+void freePCB(PCB* proc) {
+    proc->isAllocated = 0;
+    proc->nextFree = freePCBs;
+    freePCBs = proc;
+}
+
+/**
+ * Purpose:
+ * Finds the PCB for a pid in constant time
+ * 
+ * Parameters:
+ * int pid  PID of process to find
+ *
+ * Return:
+ * PCB*     PCB of the process, or NULL if there is no such process
+ */ 
+PCB* findProc(int pid) {
+    if (pid <= 0) { return NULL; }
+    PCB* proc = procTable[pid % procTableSize];
+    return (proc != NULL && proc->pid == pid) ? proc : NULL;
+}
+
+/**
+ * Purpose:
+ * Looks up a process group by ID
+ * 
+ * Parameters:
+ * int pgid     ID of group to find
+ *
+ * Return:
+ * ProcGroup*   The group, or NULL if it has no members
+ */ 
+ProcGroup* findGroup(int pgid) {
+    if (pgid <= 0) { return NULL; }
+    ProcGroup* group = groupTable[pgid % GROUP_BUCKETS];
+    while (group != NULL && group->pgid != pgid) {
+        group = group->next;
+    }
+    return group;
 }
 
 /**
  * Purpose:
- * Responsible for checking if the current processes time slice has expired.
- * If time slice expired, calls the dispatcher
+ * Checks if one process is another, or one of that process's ancestors
  * 
  * Parameters:
- * None
+ * PCB* ancestor    Process that may be an ancestor
+ * PCB* proc        Process whose parent chain to walk
  *
  * Return:
- * None
+ * int  1 if ancestor is proc or one of its ancestors, 0 otherwise
  */ 
-void timeSlice(void) {
-    checkMode("timeSlice");
-    int prevInt = disableInterrupts();
+int isAncestor(PCB* ancestor, PCB* proc) {
+    for (; proc != NULL; proc = proc->parent) {
+        if (proc == ancestor) { return 1; }
+    }
+    return 0;
+}
 
-    if (currentTime() - readCurStartTime() >= MAX_TIME_SLICE) {
-        dispatch();
+/**
+ * Purpose:
+ * Adds a process to the front of a process group's member list, creating
+ * the group if this is its first member
+ * 
+ * Parameters:
+ * PCB* proc    Process to add
+ * int pgid     ID of group to add it to
+ *
+ * Return:
+ * None
+ */ 
+void addToGroup(PCB* proc, int pgid) {
+    ProcGroup* group = findGroup(pgid);
+    if (group == NULL) {
+        group = calloc(1, sizeof(ProcGroup));
+        group->pgid = pgid;
+        group->next = groupTable[pgid % GROUP_BUCKETS];
+        groupTable[pgid % GROUP_BUCKETS] = group;
     }
 
-    restoreInterrupts(prevInt);
+    proc->group = group;
+    proc->prevInGroup = NULL;
+    proc->nextInGroup = group->head;
+    if (group->head) { group->head->prevInGroup = proc; }
+    group->head = proc;
+    group->members++;
 }
 
+/**
+ * Purpose:
+ * Takes a process out of its process group, freeing the group once it has
+ * no members left
+ * 
+ * Parameters:
+ * PCB* proc    Process to remove
+ *
+ * Return:
+ * None
+ */ 
+void removeFromGroup(PCB* proc) {
+    ProcGroup* group = proc->group;
+    if (proc->prevInGroup) { proc->prevInGroup->nextInGroup = proc->nextInGroup; }
+    else { group->head = proc->nextInGroup; }
+    if (proc->nextInGroup) { proc->nextInGroup->prevInGroup = proc->prevInGroup; }
+    proc->group = NULL;
+    proc->prevInGroup = NULL;
+    proc->nextInGroup = NULL;
+
+    group->members--;
+    if (group->members == 0) {
+        ProcGroup** link = &groupTable[group->pgid % GROUP_BUCKETS];
+        while (*link != group) {
+            link = &(*link)->next;
+        }
+        *link = group->next;
+        free(group);
+    }
+}
 
-    /* ---------- Helper Functions ---------- */
+/**
+ * Purpose:
+ * Puts a newly created process in its slot of the process table
+ * 
+ * Parameters:
+ * PCB* proc    Process to add, its pid must already be set
+ *
+ * Return:
+ * None
+ */ 
+void insertProc(PCB* proc) {
+    procTable[proc->pid % procTableSize] = proc;
+    liveProcs++;
+}
 
 /**
  * Purpose:
- * Checks the current mode of the operating system, halts if user mode attempts to
- * execute kernel functions
+ * Doubles the size of the process table. Two pids in different slots of
+ * the old table can never share a slot of the new one, so every process
+ * just moves to slot pid % procTableSize
  * 
  * Parameters:
- * char* fnName     Name of function that user mode process attempted to execute
+ * None
  *
  * Return:
  * None
  */ 
-void checkMode(char* fnName) {
-    if (!(USLOSS_PsrGet() & USLOSS_PSR_CURRENT_MODE)) {
-        USLOSS_Console("ERROR: Someone attempted to call %s while in user mode!\n",
-                fnName);
-        USLOSS_Halt(1);
+void growProcTable() {
+    int newSize = procTableSize * 2;
+    PCB** newTable = calloc(newSize, sizeof(PCB*));
+    for (int i = 0; i < procTableSize; i++) {
+        if (procTable[i] != NULL) {
+            newTable[procTable[i]->pid % newSize] = procTable[i];
+        }
     }
+    free(procTable);
+    procTable = newTable;
+    procTableSize = newSize;
 }
 
 /**
  * Purpose:
- * Disables interrupts for when executing kernel mode functions
+ * Hands out a process stack from the pool for its size class. Stacks are
+ * rounded up to a power of two and mmap()ed with a PROT_NONE guard page
+ * directly below them, so an overflow faults instead of running into
+ * whatever happens to be next in the heap. Only the top usable bytes of
+ * the stack are made accessible; everything below them is part of the
+ * guard region, and its pages are given back to the host. Stacks come
+ * back zero filled, which is the paint stackHighWater() looks for
+ * 
+ * Parameters:
+ * int size         Minimum size of the stack in bytes
+ * int usable       Bytes at the top of the stack to make accessible, 0 for all of it
+ * int* stackClass  Out pointer for the size class the stack belongs to
+ *
+ * Return:
+ * void*    Lowest address of the stack, or NULL if mmap() failed
+ */ 
+void* allocStack(int size, int usable, int* stackClass) {
+    int class = 0;
+    while (class < NUM_STACK_CLASSES - 1 && (1L << class) < size) {
+        class++;
+    }
+    *stackClass = class;
+
+    long stackSize = 1L << class;
+    if (stackSize < pageSize) { stackSize = pageSize; }
+    if (usable <= 0 || usable > stackSize) { usable = stackSize; }
+
+    // reuse a stack released by an earlier join() if there is one,
+    // moving the start of its guard region if this process needs less
+    // or more of it than the last one did
+    if (stackPool[class] != NULL) {
+        FreeStack* stack = stackPool[class];
+        stackPool[class] = stack->next;
+        char* stackMem = stack->stackMem;
+        char* top = stackMem + stackSize;
+        int reused = 1;
+        if (usable < stack->usable) {
+            // pages that stay dirty would spoil the paint if the guard
+            // region later shrinks again, and a failed mprotect() just
+            // leaves a smaller guard region than asked for
+            if (madvise(top - stack->usable, stack->usable - usable, MADV_DONTNEED) != 0) {
+                memset(top - stack->usable, 0, stack->usable - usable);
+            }
+            mprotect(top - stack->usable, stack->usable - usable, PROT_NONE);
+        }
+        else if (usable > stack->usable) {
+            reused = mprotect(top - usable, usable - stack->usable, PROT_READ | PROT_WRITE) == 0;
+        }
+        if (reused) {
+            memset(stack, 0, sizeof(FreeStack)); // restore the paint
+            return stackMem;
+        }
+        munmap(stackMem - pageSize, pageSize + stackSize); // too small, map a new one
+    }
+
+    char* region = mmap(NULL, pageSize + stackSize, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        return NULL;
+    }
+    // without a guard region the stack is still usable, it just no
+    // longer faults on overflow
+    if (mprotect(region, pageSize + stackSize - usable, PROT_NONE) != 0) {
+        USLOSS_Console("WARNING: could not guard a process stack, errno %d\n", errno);
+    }
+    return region + pageSize;
+}
+
+/**
+ * Purpose:
+ * Returns a process stack to the pool for its size class so the next
+ * fork1() of a similar size can reuse it. The part of the stack the
+ * process dirtied is zeroed first, so the next owner's high-water mark
+ * can be measured
  * 
  * Parameters:
+ * PCB* proc    Process whose stack to release; it has quit
+ *
+ * Return:
  * None
+ */ 
+void freeStack(PCB* proc) {
+    // measure again rather than trusting stackPeak, since switching away
+    // from the process after quit() took a little more stack
+    long stackSize = 1L << proc->stackClass;
+    char* top = (char*)proc->stackMem + stackSize;
+    int used = stackHighWater(proc->stackMem, proc->stackClass, proc->stackUsable);
+    memset(top - used, 0, used);
+
+    FreeStack* stack = (FreeStack*)(top - sizeof(FreeStack));
+    stack->stackMem = proc->stackMem;
+    stack->usable = proc->stackUsable;
+    stack->next = stackPool[proc->stackClass];
+    stackPool[proc->stackClass] = stack;
+}
+
+/**
+ * Purpose:
+ * Measures how deep a stack has been used by scanning up from the bottom
+ * of its accessible part for the first word that is no longer zero
+ * 
+ * Parameters:
+ * void* stackMem   Lowest address of the stack
+ * int stackClass   Size class of the stack
+ * int usable       Bytes at the top of the stack that are accessible
  *
  * Return:
- * int  State that interrupts were in before function call
+ * int  Bytes of the stack in use, measured down from its top
  */ 
-int disableInterrupts() {
-    int prevInt = USLOSS_PsrGet() & USLOSS_PSR_CURRENT_INT; // previous interrupt status
-    USLOSS_PsrSet(prevInt & ~USLOSS_PSR_CURRENT_INT);
-    return prevInt;
+int stackHighWater(void* stackMem, int stackClass, int usable) {
+    long* top = (long*)((char*)stackMem + (1L << stackClass));
+    long* word = top - usable / sizeof(long);
+    while (word < top && *word == 0) {
+        word++;
+    }
+    return (top - word) * sizeof(long);
 }
 
 /**
  * Purpose:
- * Restores interrupts after kernel function has finished executing
+ * Looks up the stack profile for a process name
  * 
  * Parameters:
- * int prevInt  State that interrupts were in before function call
+ * char* name   Process name
+ * int create   1 to create an empty profile if there is none
+ *
+ * Return:
+ * StackProfile*    The profile, or NULL if there is none and create is 0
+ */ 
+StackProfile* findStackProfile(char* name, int create) {
+    unsigned int hash = 5381;
+    for (char* c = name; *c; c++) {
+        hash = hash * 33 + *c;
+    }
+
+    StackProfile** bucket = &stackProfiles[hash % PROFILE_BUCKETS];
+    StackProfile* profile = *bucket;
+    while (profile != NULL && strcmp(profile->name, name) != 0) {
+        profile = profile->next;
+    }
+    if (profile == NULL && create) {
+        profile = calloc(1, sizeof(StackProfile));
+        strcpy(profile->name, name);
+        profile->next = *bucket;
+        *bucket = profile;
+    }
+    return profile;
+}
+
+/**
+ * Purpose:
+ * Adds a quitting process's stack peak to the profile for its name
+ * 
+ * Parameters:
+ * char* name   Process name
+ * int peak     Bytes of stack the process used
  *
  * Return:
  * None
  */ 
-void restoreInterrupts(int prevInt) {
-    USLOSS_PsrSet(USLOSS_PsrGet() | prevInt);
+void recordStackPeak(char* name, int peak) {
+    StackProfile* profile = findStackProfile(name, 1);
+    if (peak > profile->peak) { profile->peak = peak; }
+    profile->samples++;
+}
+
+/**
+ * Purpose:
+ * In profile-guided stack mode (PHASE1_STACK_PROFILE kernel parameter),
+ * works out how much stack a new process needs from the deepest use seen
+ * by earlier processes with the same name
+ * 
+ * Parameters:
+ * char* name   Name of the process being forked
+ *
+ * Return:
+ * int  Bytes of stack to make accessible, 0 for all of it
+ */ 
+int profiledStack(char* name) {
+    if (!stackSizing) { return 0; }
+    StackProfile* profile = findStackProfile(name, 0);
+    return profile ? profiledSize(profile) : 0;
+}
+
+/**
+ * Purpose:
+ * Returns the stack size a profile calls for: the peak plus half again,
+ * and never less than STACK_MARGIN of headroom, rounded up to a page
+ * 
+ * Parameters:
+ * StackProfile* profile    Profile to size from
+ *
+ * Return:
+ * int  Stack size in bytes
+ */ 
+int profiledSize(StackProfile* profile) {
+    int margin = profile->peak / 2 > STACK_MARGIN ? profile->peak / 2 : STACK_MARGIN;
+    long size = profile->peak + margin;
+    return (size + pageSize - 1) / pageSize * pageSize;
 }
 
 /**
@@ -660,7 +2653,11 @@ void trampoline() {
 /**
  * Purpose:
  * Responsible for choosing which process to run next. Performs round robin with
- * 80 millisecond quantum time slicing to choose which process to run next
+ * 80 millisecond quantum time slicing to choose which process to run next.
+ * The highest non-empty run queue is found with a single find-first-set on
+ * readyMask, and the clock is read only once per call. In MLFQ mode a
+ * process that uses up its whole quantum is moved down a level. EDF
+ * processes run ahead of every fixed priority, earliest deadline first
  * 
  * Parameters:
  * None
@@ -670,49 +2667,102 @@ void trampoline() {
  */ 
 void dispatch() {
     int prevInt = disableInterrupts();
+    needResched = 0;
+
+    PCB* handoff = handoffTo;
+    handoffTo = NULL;
+    int yielded = yielding;
+    yielding = 0;
 
+    int now = currentTime();
     int curCpuTime = 0;
     if (currentProc) {
-        curCpuTime = currentTime()-readCurStartTime();
-        if (currentProc->runState == RUNNING) { addToQueue(currentProc); }
-    }
-
-    // select a new process (or the current one) to run
-    PCB* new;
-    for (int i = 0; i < NUMPRIORITIES; i++) {
-        Queue* q = &queues[i];
-
-        if (currentProc && i+1 == currentProc->priority && currentProc->runState == RUNNING && !(curCpuTime > MAX_TIME_SLICE)) {
-            new = currentProc;
-            removeFromQueue(new);
-            break;
+        curCpuTime = now - currentProc->currentStartTime;
+        int level = currentProc->runPriority;
+        int expired = sliceUsedUp(currentProc, now);
+        if (expired && currentProc->runState == RUNNING) {
+            currentProc->stats.sliceExpirations++;
         }
 
-        if (q->head == NULL) { continue; } // nothing available at this priority
+        // MLFQ: burning the whole quantum costs a level (user levels only)
+        if (schedMode == SCHED_MLFQ && expired && currentProc->runState == RUNNING && !currentProc->period &&
+            !currentProc->boostedFrom && currentProc->runPriority < 5 && currentProc->priority <= 5) {
+            currentProc->runPriority++;
+        }
 
-        new = q->head;
-        removeFromQueue(new);
-        break;
+        // fast path: keep running if nothing of higher priority is ready,
+        // the current time slice has not expired and the process did not
+        // yield. An EDF process takes the slow path once its budget is gone
+        // (so chargeCpu() can drop it out of the EDF queue) or an earlier
+        // deadline is waiting
+        unsigned int higher = (1u << currentProc->runPriority) - 1;
+        PCB* edfHead = queues[EDF_PRIORITY].head;
+        int edfDone = isEdf(currentProc) &&
+            (expired || (edfHead && edfHead->deadline < currentProc->deadline));
+        if (currentProc->runState == RUNNING && !(readyMask & higher) && !edfDone && !yielded) {
+            if (!expired) {
+                restoreInterrupts(prevInt);
+                return;
+            }
+            // slice expired: go to the back of the line, but only switch
+            // if someone else is waiting at this priority
+            if (queues[currentProc->runPriority].head == NULL) {
+                recordSlice(level, now - currentProc->sliceStart, 1);
+                chargeCpu(currentProc, curCpuTime);
+                currentProc->currentStartTime = now;
+                currentProc->sliceStart = now;
+                restoreInterrupts(prevInt);
+                return;
+            }
+        }
+        recordSlice(level, now - currentProc->sliceStart, expired && currentProc->runState == RUNNING);
+        chargeCpu(currentProc, curCpuTime);
+        currentProc->currentStartTime = now;
+        if (currentProc->runState == RUNNING) { addToQueue(currentProc); }
     }
 
-    // if we've selected the currently running process, simply return and continue running
-    if (new == currentProc) { 
-        if (curCpuTime > MAX_TIME_SLICE) {
-            currentProc->totalCpuTime = currentProc->totalCpuTime + curCpuTime;
-            currentProc->currentStartTime = currentTime();
-        }
+    // select the head of the highest priority non-empty run queue, unless
+    // a handoff target is waiting that is at least as important
+    int top = __builtin_ffs(readyMask) - 1;
+    int donate = handoff != NULL && handoff->runState == RUNNABLE &&
+        handoff->runPriority <= top && currentProc != NULL;
+    PCB* new = donate ? handoff : queues[top].head;
+    removeFromQueue(new);
+    if (isStride(new)) { globalPass = new->pass; }
+
+    // under stride scheduling the current process can still have the lowest pass
+    if (new == currentProc) {
+        currentProc->sliceStart = now;
+        restoreInterrupts(prevInt);
         return;
     }
-    else if (currentProc) {
-        if (currentProc->runState == RUNNING) { currentProc->runState = RUNNABLE; }
-        currentProc->totalCpuTime = currentProc->totalCpuTime + curCpuTime;
+
+    if (currentProc) {
+        if (currentProc->runState == RUNNING) {
+            enterState(currentProc, RUNNABLE, now);
+            if (yielded) { currentProc->stats.voluntarySwitches++; }
+            else { currentProc->stats.involuntarySwitches++; }
+        }
+        else {
+            currentProc->stats.voluntarySwitches++;
+        }
     }
 
-    // set new as the new currentProc, then context switch to it
+    // set new as the new currentProc, then context switch to it; the old
+    // process can only get here from kernel code
     PCB* oldProc = currentProc;
-    new->currentStartTime = currentTime();
-    new->runState = RUNNING;
+    if (oldProc) { chargeMode(oldProc, now, 1); }
+    new->modeSince = now;
+    new->currentStartTime = now;
+    new->sliceStart = donate ? oldProc->sliceStart : now;
+    if (new->agedFrom) {
+        // aging only lasts until the process gets the CPU
+        new->runPriority = new->agedFrom;
+        new->agedFrom = 0;
+    }
+    enterState(new, RUNNING, now);
     currentProc = new;
+    traceEvent(TRACE_SWITCH, new->pid, oldProc ? oldProc->pid : 0);
 
     restoreInterrupts(prevInt);
     if (oldProc) {
@@ -723,6 +2773,170 @@ void dispatch() {
     }
 }
 
+/**
+ * Purpose:
+ * Records a scheduler event in the trace ring buffer, overwriting the
+ * oldest event once the buffer is full. Does nothing unless tracing was
+ * turned on with the PHASE1_TRACE kernel parameter
+ * 
+ * Parameters:
+ * int type     Event type (one of the TRACE_ values in trace.h)
+ * int pid      Process the event is about
+ * int arg      Event specific detail, see trace.h
+ *
+ * Return:
+ * None
+ */ 
+void traceEvent(int type, int pid, int arg) {
+    if (traceBuf == NULL) { return; }
+
+    TraceEvent* event = &traceBuf[traceCount % traceSize];
+    event->time = currentTime();
+    event->type = type;
+    event->pid = pid;
+    event->arg = arg;
+    traceCount++;
+}
+
+/**
+ * Purpose:
+ * Writes the trace ring buffer, oldest event first, to the file named by
+ * the PHASE1_TRACE_FILE environment variable (phase1.trace by default).
+ * Registered with atexit() so it runs when the simulation halts
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void traceDump() {
+    char* fileName = getenv("PHASE1_TRACE_FILE");
+    FILE* file = fopen(fileName ? fileName : "phase1.trace", "wb");
+    if (file == NULL) { return; }
+
+    TraceHeader header;
+    header.magic = TRACE_MAGIC;
+    header.version = TRACE_VERSION;
+    header.count = traceCount < traceSize ? traceCount : traceSize;
+    header.dropped = traceCount - header.count;
+    fwrite(&header, sizeof(header), 1, file);
+
+    // once the buffer has wrapped the oldest event is the next to be overwritten
+    int first = traceCount < traceSize ? 0 : traceCount % traceSize;
+    fwrite(&traceBuf[first], sizeof(TraceEvent), header.count - first, file);
+    fwrite(traceBuf, sizeof(TraceEvent), first, file);
+    fclose(file);
+}
+
+/**
+ * Purpose:
+ * Records the length of a time slice that just ended, for dumpSlices().
+ * EDF slices are bounded by budgets, not quanta, and are not recorded
+ * 
+ * Parameters:
+ * int priority     Priority the slice ran at
+ * int length       Length of the slice in microseconds
+ * int expired      1 if the slice ended because the quantum ran out
+ *
+ * Return:
+ * None
+ */ 
+void recordSlice(int priority, int length, int expired) {
+    if (priority == EDF_PRIORITY) { return; }
+    sliceCount[priority - 1]++;
+    sliceTotal[priority - 1] += length;
+    if (length > sliceMax[priority - 1]) { sliceMax[priority - 1] = length; }
+    sliceExpired[priority - 1] += expired;
+}
+
+/**
+ * Purpose:
+ * Runs every pending kernel task, oldest first, including any queued by
+ * the tasks themselves. The tasks run on the task context's own stack, not
+ * on the stack of whatever process was interrupted, so a process whose
+ * stack was sized from a profile has no driver work to make room for.
+ * Wakeups done by the tasks are held until the last one returns
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void runKernelTasks() {
+    if (inKernelTask || taskCount == 0) { return; }
+    int prevInt = disableInterrupts();
+
+    inKernelTask = 1;
+    USLOSS_ContextSwitch(&taskReturn, &taskContext);
+    inKernelTask = 0;
+
+    restoreInterrupts(prevInt);
+}
+
+/**
+ * Purpose:
+ * Main function of the kernel task context. Each time runKernelTasks()
+ * switches to it, it runs the pending tasks and switches back
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * None
+ */ 
+void taskMain() {
+    while (1) {
+        disableInterrupts();
+        while (taskCount > 0) {
+            KernelTask task = taskQueue[taskHead];
+            taskHead = (taskHead + 1) % TASK_QUEUE_SIZE;
+            taskCount--;
+            task.func(task.arg1, task.arg2);
+        }
+        USLOSS_ContextSwitch(&taskContext, &taskReturn);
+    }
+}
+
+/**
+ * Purpose:
+ * Adds a child that has quit() to its parent's list of dead children.
+ * The list is kept newest-forked first (highest pid first), which is the
+ * order join() has always reaped children in. Children usually die either
+ * oldest-first or newest-first, so the new entry almost always goes at the
+ * head or the tail and only unusual orders walk the list
+ * 
+ * Parameters:
+ * PCB* parent  Process whose list the child goes on
+ * PCB* child   Child that just quit()
+ *
+ * Return:
+ * None
+ */ 
+void addToDeadList(PCB* parent, PCB* child) {
+    if (parent->deadHead == NULL) {
+        parent->deadHead = child;
+        parent->deadTail = child;
+    }
+    else if (child->pid > parent->deadHead->pid) {
+        child->nextDead = parent->deadHead;
+        parent->deadHead = child;
+    }
+    else if (child->pid < parent->deadTail->pid) {
+        parent->deadTail->nextDead = child;
+        parent->deadTail = child;
+    }
+    else {
+        PCB* prev = parent->deadHead;
+        while (prev->nextDead->pid > child->pid) {
+            prev = prev->nextDead;
+        }
+        child->nextDead = prev->nextDead;
+        prev->nextDead = child;
+    }
+}
+
 /**
  * Purpose:
  * Responsible for adding a process to its respective run queue
@@ -734,7 +2948,30 @@ void dispatch() {
  * None
  */ 
 void addToQueue(PCB* process) {
-    Queue* addTo = &queues[(process->priority)-1];
+    Queue* addTo = &queues[process->runPriority];
+    readyMask |= 1u << process->runPriority;
+
+    // the stride queue is kept sorted by pass and the EDF queue by deadline
+    // instead of FIFO
+    int edf = isEdf(process);
+    if (isStride(process) || edf) {
+        // don't let time spent blocked bank credit against everyone else
+        if (!edf && process->pass < globalPass) { process->pass = globalPass; }
+
+        PCB* next = addTo->head;
+        while (next != NULL && (edf ? next->deadline <= process->deadline : next->pass <= process->pass)) {
+            next = next->nextInQueue;
+        }
+        if (next != NULL) {
+            process->nextInQueue = next;
+            process->prevInQueue = next->prevInQueue;
+            if (next->prevInQueue) { next->prevInQueue->nextInQueue = process; }
+            else { addTo->head = process; }
+            next->prevInQueue = process;
+            return;
+        }
+    }
+
     if (addTo->head == NULL || addTo->tail == NULL) {
         addTo->head = process;
         addTo->tail = process;
@@ -758,7 +2995,7 @@ void addToQueue(PCB* process) {
  */ 
 void removeFromQueue(PCB* process) {
     // change the queue's head and/or tail pointer(s) if applicable
-    Queue* removeFrom = &queues[(process->priority)-1];
+    Queue* removeFrom = &queues[process->runPriority];
     if (removeFrom->head == process) { 
         removeFrom->head = process->nextInQueue;
     }
@@ -777,6 +3014,46 @@ void removeFromQueue(PCB* process) {
     // clean up process's queue pointers
     process->prevInQueue = NULL;
     process->nextInQueue = NULL;
+
+    if (removeFrom->head == NULL) {
+        readyMask &= ~(1u << process->runPriority);
+    }
+}
+
+/**
+ * Purpose:
+ * Raises the priority of processes that have been waiting on a run queue,
+ * one level for every agingRate microseconds waited, but no higher than
+ * agingCap, so low priority work cannot starve forever behind a steady
+ * stream of higher priority work. The raise is undone when the process
+ * next gets the CPU. Stride scheduled processes (which already get a fair
+ * share), init, the sentinel and processes holding an inherited priority
+ * are left alone. Called from the clock interrupt
+ * 
+ * Parameters:
+ * int now  Current time
+ *
+ * Return:
+ * None
+ */ 
+void ageProcesses(int now) {
+    for (int level = 5; level > agingCap; level--) {
+        PCB* next;
+        for (PCB* proc = queues[level].head; proc != NULL; proc = next) {
+            next = proc->nextInQueue;
+            if (isStride(proc) || proc->priority > 5 || proc->boostedFrom) { continue; }
+
+            int natural = proc->agedFrom ? proc->agedFrom : proc->runPriority;
+            int target = natural - (now - proc->stateSince) / agingRate;
+            if (target < agingCap) { target = agingCap; }
+            if (target >= proc->runPriority) { continue; }
+
+            proc->stats.agingPromotions += proc->runPriority - target;
+            proc->agedFrom = natural;
+            setRunPriority(proc, target);
+            if (currentProc && target < currentProc->runPriority) { needResched = 1; }
+        }
+    }
 }
 
 /**
@@ -791,8 +3068,32 @@ void removeFromQueue(PCB* process) {
  * None
  */ 
 static void clockHandler(int dev, void* arg) {
+    // tickless idle: with only the sentinel runnable there is nothing to
+    // slice or age, so skip the tick unless a later phase asked for it. A
+    // request is used up by the first tick at or after its time, idle or not
+    if (tickless) {
+        int now = currentTime();
+        if (now < nextTick) {
+            if (currentProc->priority == 7 && readyMask == 0) {
+                idleTicks++;
+                return;
+            }
+        }
+        else {
+            nextTick = NO_TICK;
+        }
+    }
+
+    int token = enterCpuMode(CPU_INTERRUPT, USLOSS_CLOCK_INT);
     phase2_clockHandler();
+    runKernelTasks();
+    if (edfProcs) { edfTick(currentTime()); }
+    if (agingRate > 0) { ageProcesses(currentTime()); }
     timeSlice();
+    if (needResched) {
+        dispatch();
+    }
+    leaveCpuMode(token);
 }
 
 
@@ -817,6 +3118,7 @@ void initMain() {
 
     // create sentinel and testcase_main
     int sentinelPid = fork1("sentinel", &sentinelMain, NULL, USLOSS_MIN_STACK, 7);
+    setProcGroup(sentinelPid, 0); // keep the sentinel out of zapGroup(1)
     int testcaseMainPid = fork1("testcase_main", &testcaseMainMain, NULL, USLOSS_MIN_STACK, 3);
 
     // continuously clean up dead children
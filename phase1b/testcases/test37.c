@@ -0,0 +1,94 @@
+/* Tests zapGroup() with two zappers on the same group, and with a zapper
+ * whose own parent is in the group it zaps
+ *
+ * testcase_main creates Member1 and Member2 at priority 5 and moves them
+ * into a group of their own, then creates Zapper1 and Zapper2 at priority
+ * 4, which both zap that group.  Neither zapper may return until both
+ * members have quit, and both report that they waited for 2 processes.
+ *
+ * testcase_main then creates Parent at priority 4 in a new group.  Parent
+ * creates Child (priority 4) and Spinner (priority 5) in its group and
+ * joins.  Child zaps its own group: Parent is its ancestor, so it is
+ * skipped instead of being zapped while it waits in join(); only Spinner
+ * is zapped.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+
+int Member(char *);
+int Zapper(char *);
+int Parent(char *);
+int Child(char *);
+
+int pgid;
+
+int testcase_main()
+{
+    int status, kidpid, member1, member2;
+
+    USLOSS_Console("testcase_main(): started\n");
+    USLOSS_Console("EXPECTATION: both zappers return 2 after both members quit; Child returns 1 after Spinner quits\n");
+
+    member1 = fork1("Member1", Member, "Member1", USLOSS_MIN_STACK, 5);
+    member2 = fork1("Member2", Member, "Member2", USLOSS_MIN_STACK, 5);
+    setProcGroup(member1, 0);
+    setProcGroup(member2, member1);
+    pgid = member1;
+    USLOSS_Console("testcase_main(): members %d and %d are in group %d\n",
+                   member1, member2, getProcGroup(member2));
+
+    fork1("Zapper1", Zapper, "Zapper1", USLOSS_MIN_STACK, 4);
+    fork1("Zapper2", Zapper, "Zapper2", USLOSS_MIN_STACK, 4);
+
+    for (int i = 0; i < 4; i++) {
+        kidpid = join(&status);
+        USLOSS_Console("testcase_main(): exit status for child %d is %d\n", kidpid, status);
+    }
+
+    kidpid = fork1("Parent", Parent, "Parent", USLOSS_MIN_STACK, 4);
+    setProcGroup(kidpid, 0);
+    kidpid = join(&status);
+    USLOSS_Console("testcase_main(): exit status for child %d is %d\n", kidpid, status);
+
+    return 0;
+}
+
+int Member(char *arg)
+{
+    while (!isZapped()) {
+    }
+    USLOSS_Console("%s(): zapped, quitting\n", arg);
+    quit(1);
+}
+
+int Zapper(char *arg)
+{
+    USLOSS_Console("%s(): zapping group %d\n", arg, pgid);
+    int zapped = zapGroup(pgid);
+    USLOSS_Console("%s(): zapGroup returned %d\n", arg, zapped);
+    quit(2);
+}
+
+int Parent(char *arg)
+{
+    int status, kidpid;
+
+    fork1("Child", Child, "Child", USLOSS_MIN_STACK, 4);
+    fork1("Spinner", Member, "Spinner", USLOSS_MIN_STACK, 5);
+    for (int i = 0; i < 2; i++) {
+        kidpid = join(&status);
+        USLOSS_Console("Parent(): exit status for child %d is %d\n", kidpid, status);
+    }
+    quit(3);
+}
+
+int Child(char *arg)
+{
+    int group = getProcGroup(getpid());
+    USLOSS_Console("Child(): zapping my own group %d, which holds my parent\n", group);
+    int zapped = zapGroup(group);
+    USLOSS_Console("Child(): zapGroup returned %d\n", zapped);
+    quit(4);
+}
@@ -0,0 +1,78 @@
+/* Tests priority inheritance through blockMeOn() and setWaitOwner()
+ *
+ * testcase_main creates Owner1 and Owner2 at priority 5 and Medium at
+ * priority 4, then Waiter at priority 1.  Waiter runs at once and blocks
+ * with blockMeOn(), waiting on a resource that Owner1 holds.
+ *
+ * Owner1 inherits Waiter's priority, so it runs ahead of testcase_main and
+ * Medium, and hands the resource to Owner2 with setWaitOwner().  Owner2
+ * now inherits Waiter's priority, and also runs ahead of them; it unblocks
+ * Waiter.  testcase_main then joins, and Medium runs last.
+ *
+ * test39 runs this with PHASE1_INHERIT set to 0, where testcase_main and
+ * Medium run first.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+
+#define WAIT_RESOURCE  20
+
+int Owner1(char *);
+int Owner2(char *);
+int Waiter(char *);
+int Medium(char *);
+
+int owner1, owner2, waiter;
+
+int testcase_main()
+{
+    int status, kidpid;
+
+    USLOSS_Console("testcase_main(): started\n");
+    USLOSS_Console("EXPECTATION: with inheritance, Owner1 and Owner2 run before testcase_main and Medium while Waiter waits on them\n");
+
+    owner1 = fork1("Owner1", Owner1, "Owner1", USLOSS_MIN_STACK, 5);
+    owner2 = fork1("Owner2", Owner2, "Owner2", USLOSS_MIN_STACK, 5);
+    fork1("Medium", Medium, "Medium", USLOSS_MIN_STACK, 4);
+    fork1("Waiter", Waiter, "Waiter", USLOSS_MIN_STACK, 1);
+    USLOSS_Console("testcase_main(): joining\n");
+
+    for (int i = 0; i < 4; i++) {
+        kidpid = join(&status);
+        USLOSS_Console("testcase_main(): exit status for child %d is %d\n", kidpid, status);
+    }
+
+    return 0;
+}
+
+int Waiter(char *arg)
+{
+    waiter = getpid();
+    USLOSS_Console("Waiter(): waiting on Owner1\n");
+    blockMeOn(WAIT_RESOURCE, owner1);
+    USLOSS_Console("Waiter(): got the resource\n");
+    quit(3);
+}
+
+int Owner1(char *arg)
+{
+    USLOSS_Console("Owner1(): handing the resource to Owner2\n");
+    USLOSS_Console("Owner1(): setWaitOwner() returned %d\n", setWaitOwner(waiter, owner2));
+    USLOSS_Console("Owner1(): setWaitOwner() on a running process returned %d\n", setWaitOwner(getpid(), owner2));
+    quit(1);
+}
+
+int Owner2(char *arg)
+{
+    USLOSS_Console("Owner2(): releasing the resource\n");
+    unblockProc(waiter);
+    quit(2);
+}
+
+int Medium(char *arg)
+{
+    USLOSS_Console("Medium(): ran\n");
+    quit(4);
+}
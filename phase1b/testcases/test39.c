@@ -0,0 +1,17 @@
+/* Tests blockMeOn() and setWaitOwner() with priority inheritance turned off
+ *
+ * The same processes as test38, with PHASE1_INHERIT set to 0 before the
+ * kernel reads it.  Nobody inherits Waiter's priority, so testcase_main
+ * and Medium run before Owner1 and Owner2.
+ */
+
+#include <stdlib.h>
+
+static void noInheritance(void) __attribute__((constructor));
+
+static void noInheritance(void)
+{
+    setenv("PHASE1_INHERIT", "0", 1);
+}
+
+#include "test38.c"
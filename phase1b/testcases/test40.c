@@ -0,0 +1,79 @@
+/* Tests the earliest-deadline-first class: admission, running out of
+ * budget, and deadline misses
+ *
+ * testcase_main creates Hog at priority 4.  It checks that setRealTime()
+ * rejects a budget longer than the period (-1) and a share over the
+ * default 90% limit (-2), then admits Hog with a 60ms budget every 100ms.
+ *
+ * Hog runs at once at EDF priority.  It checks that testcase_main can't
+ * also be admitted with 40ms every 100ms, since that would reserve 100%
+ * of the CPU.  Hog then spins without blocking.  Once its budget is gone
+ * it drops to its normal priority 4, testcase_main runs and joins, and
+ * Hog keeps the CPU.  It is still runnable at its deadline, which
+ * getProcStats() counts as a deadline miss.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+
+#define PERIOD      100000
+#define TIME_LIMIT  2000000
+
+int Hog(char *);
+
+int mainPid;
+
+int testcase_main()
+{
+    int status, kidpid, hog;
+
+    USLOSS_Console("testcase_main(): started\n");
+    USLOSS_Console("EXPECTATION: Hog is admitted, runs out of budget, drops to priority 4 and misses a deadline\n");
+
+    mainPid = getpid();
+    hog = fork1("Hog", Hog, "Hog", USLOSS_MIN_STACK, 4);
+
+    USLOSS_Console("testcase_main(): setRealTime() with budget > period returned %d\n",
+                   setRealTime(hog, PERIOD, 2 * PERIOD));
+    USLOSS_Console("testcase_main(): setRealTime() for 95%% of the CPU returned %d\n",
+                   setRealTime(hog, PERIOD, 95000));
+    USLOSS_Console("testcase_main(): admitting Hog for 60%% of the CPU\n");
+    int result = setRealTime(hog, PERIOD, 60000);
+    USLOSS_Console("testcase_main(): setRealTime() returned %d\n", result);
+
+    kidpid = join(&status);
+    USLOSS_Console("testcase_main(): exit status for child %d is %d\n", kidpid, status);
+
+    return 0;
+}
+
+int Hog(char *arg)
+{
+    ProcStats stats;
+    int sawEdf = 0, sawNormal = 0;
+
+    USLOSS_Console("Hog(): setRealTime() for another 40%% of the CPU returned %d\n",
+                   setRealTime(mainPid, PERIOD, 40000));
+
+    int start = currentTime();
+    while (currentTime() - start < TIME_LIMIT) {
+        getProcStats(getpid(), &stats);
+        if (stats.runPriority == 0) {
+            sawEdf = 1;
+        }
+        if (stats.runPriority == 4) {
+            sawNormal = 1;
+        }
+        if (sawNormal && stats.budgetOverruns > 0 && stats.deadlineMisses > 0) {
+            break;
+        }
+    }
+
+    USLOSS_Console("Hog(): ran at EDF priority: %s\n", sawEdf ? "yes" : "no");
+    USLOSS_Console("Hog(): dropped to priority 4 after using its budget: %s\n",
+                   sawNormal && stats.budgetOverruns > 0 ? "yes" : "no");
+    USLOSS_Console("Hog(): deadline miss counted: %s\n", stats.deadlineMisses > 0 ? "yes" : "no");
+
+    quit(1);
+}
@@ -0,0 +1,72 @@
+/* Tests that stride scheduling shares the CPU in proportion to tickets
+ *
+ * Runs with PHASE1_SCHED set to stride.  testcase_main creates Worker1,
+ * Worker2 and Worker3 at priority 4 holding 100, 200 and 300 tickets
+ * (children inherit their parent's tickets, so testcase_main sets its own
+ * before each fork1()).  Each worker spins until the same point in time,
+ * then reports the CPU time getProcStats() charged it.  Worker2 should get
+ * about twice Worker1's CPU time and Worker3 about three times, to within
+ * a quarter: each time slice is charged whole, so over a few seconds the
+ * shares are only roughly exact.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <usloss.h>
+#include <phase1.h>
+
+#define RUN_TIME  3000000
+
+int Worker(char *);
+
+int endTime;
+int cpuTime[4];
+
+static void strideScheduling(void) __attribute__((constructor));
+
+static void strideScheduling(void)
+{
+    setenv("PHASE1_SCHED", "stride", 1);
+}
+
+int testcase_main()
+{
+    int status;
+
+    USLOSS_Console("testcase_main(): started\n");
+    USLOSS_Console("EXPECTATION: CPU time is shared 1:2:3, like the tickets\n");
+
+    endTime = currentTime() + RUN_TIME;
+    setTickets(getpid(), 100);
+    fork1("Worker1", Worker, "1", USLOSS_MIN_STACK, 4);
+    setTickets(getpid(), 200);
+    fork1("Worker2", Worker, "2", USLOSS_MIN_STACK, 4);
+    setTickets(getpid(), 300);
+    fork1("Worker3", Worker, "3", USLOSS_MIN_STACK, 4);
+
+    for (int i = 0; i < 3; i++) {
+        join(&status);
+    }
+
+    double ratio2 = (double)cpuTime[2] / cpuTime[1];
+    double ratio3 = (double)cpuTime[3] / cpuTime[1];
+    USLOSS_Console("testcase_main(): Worker2 got about twice Worker1's CPU time: %s\n",
+                   ratio2 > 1.5 && ratio2 < 2.5 ? "yes" : "no");
+    USLOSS_Console("testcase_main(): Worker3 got about three times Worker1's CPU time: %s\n",
+                   ratio3 > 2.25 && ratio3 < 3.75 ? "yes" : "no");
+
+    return 0;
+}
+
+int Worker(char *arg)
+{
+    ProcStats stats;
+    int id = atoi(arg);
+
+    while (currentTime() < endTime) {
+    }
+    getProcStats(getpid(), &stats);
+    cpuTime[id] = stats.cpuTime;
+
+    quit(id);
+}
@@ -0,0 +1,82 @@
+/* Tests that the multi-level feedback queue demotes a CPU hog and
+ * promotes a process that blocks before its quantum is used
+ *
+ * Runs with PHASE1_SCHED set to mlfq.  testcase_main creates Helper at
+ * priority 5, then Worker at priority 2.  Worker spins, using up its
+ * quantum at each level, until it has been demoted to level 5.  It then
+ * blocks at once each time it runs, and Helper wakes it.  Each early
+ * block moves Worker up a level, but never above priority 2.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <usloss.h>
+#include <phase1.h>
+
+#define WAIT_HELPER  20
+#define TIME_LIMIT   2000000
+
+int Worker(char *);
+int Helper(char *);
+
+int worker;
+int waiting;
+int done;
+
+static void mlfqScheduling(void) __attribute__((constructor));
+
+static void mlfqScheduling(void)
+{
+    setenv("PHASE1_SCHED", "mlfq", 1);
+}
+
+int testcase_main()
+{
+    int status, kidpid;
+
+    USLOSS_Console("testcase_main(): started\n");
+    USLOSS_Console("EXPECTATION: Worker sinks to level 5 while it spins, then climbs back to 2 as it blocks\n");
+
+    fork1("Helper", Helper, "Helper", USLOSS_MIN_STACK, 5);
+    fork1("Worker", Worker, "Worker", USLOSS_MIN_STACK, 2);
+
+    for (int i = 0; i < 2; i++) {
+        kidpid = join(&status);
+        USLOSS_Console("testcase_main(): exit status for child %d is %d\n", kidpid, status);
+    }
+
+    return 0;
+}
+
+int Worker(char *arg)
+{
+    ProcStats stats;
+
+    worker = getpid();
+    int start = currentTime();
+    do {
+        getProcStats(worker, &stats);
+    } while (stats.runPriority < 5 && currentTime() - start < TIME_LIMIT);
+    USLOSS_Console("Worker(): demoted to level 5 by spinning: %s\n", stats.runPriority == 5 ? "yes" : "no");
+
+    for (int i = 0; i < 5; i++) {
+        waiting = 1;
+        blockMe(WAIT_HELPER);
+        getProcStats(worker, &stats);
+        USLOSS_Console("Worker(): level after blocking early: %d\n", stats.runPriority);
+    }
+
+    done = 1;
+    quit(2);
+}
+
+int Helper(char *arg)
+{
+    while (!done) {
+        if (waiting) {
+            waiting = 0;
+            unblockProc(worker);
+        }
+    }
+    quit(5);
+}
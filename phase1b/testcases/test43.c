@@ -0,0 +1,65 @@
+/* Tests yieldTo(): handing the CPU to a chosen process, and its return
+ * values
+ *
+ * testcase_main creates ChildA, ChildB and ChildC at its own priority, 3,
+ * so they wait on the run queue in that order.  yieldTo(ChildC) runs
+ * ChildC first, then the queue carries on with ChildA and ChildB before
+ * testcase_main gets the CPU back, and yieldTo() returns 0.
+ *
+ * testcase_main then hands the CPU to Sleeper, which blocks.  yieldTo()
+ * returns 1 (a plain yield) for the blocked Sleeper and for testcase_main
+ * itself, and -1 for a pid that doesn't exist.
+ */
+
+#include <stdio.h>
+#include <usloss.h>
+#include <phase1.h>
+
+#define WAIT_WAKEUP  20
+#define NO_SUCH_PID  9999
+
+int Child(char *);
+int Sleeper(char *);
+
+int testcase_main()
+{
+    int status, kidpid, childC, sleeper;
+
+    USLOSS_Console("testcase_main(): started\n");
+    USLOSS_Console("EXPECTATION: ChildC runs before ChildA and ChildB; yieldTo() returns 0, 0, 1, 1, -1\n");
+
+    fork1("ChildA", Child, "ChildA", USLOSS_MIN_STACK, 3);
+    fork1("ChildB", Child, "ChildB", USLOSS_MIN_STACK, 3);
+    childC = fork1("ChildC", Child, "ChildC", USLOSS_MIN_STACK, 3);
+
+    USLOSS_Console("testcase_main(): yielding to ChildC\n");
+    USLOSS_Console("testcase_main(): yieldTo(ChildC) returned %d\n", yieldTo(childC));
+
+    sleeper = fork1("Sleeper", Sleeper, "Sleeper", USLOSS_MIN_STACK, 3);
+    USLOSS_Console("testcase_main(): yieldTo(Sleeper) returned %d\n", yieldTo(sleeper));
+    USLOSS_Console("testcase_main(): yieldTo(Sleeper) while it is blocked returned %d\n", yieldTo(sleeper));
+    USLOSS_Console("testcase_main(): yieldTo(myself) returned %d\n", yieldTo(getpid()));
+    USLOSS_Console("testcase_main(): yieldTo(%d) returned %d\n", NO_SUCH_PID, yieldTo(NO_SUCH_PID));
+
+    unblockProc(sleeper);
+    for (int i = 0; i < 4; i++) {
+        kidpid = join(&status);
+        USLOSS_Console("testcase_main(): exit status for child %d is %d\n", kidpid, status);
+    }
+
+    return 0;
+}
+
+int Child(char *arg)
+{
+    USLOSS_Console("%s(): running\n", arg);
+    quit(1);
+}
+
+int Sleeper(char *arg)
+{
+    USLOSS_Console("Sleeper(): blocking\n");
+    blockMe(WAIT_WAKEUP);
+    USLOSS_Console("Sleeper(): woken\n");
+    quit(2);
+}
@@ -0,0 +1,311 @@
+/**
+ * File: traceview.c
+ * Authors: David McLain, Miles Gendreau
+ *
+ * Purpose: traceview.c is a host side analyzer for the scheduler event
+ * trace the phase 1 kernel writes when run with PHASE1_TRACE set. It
+ * replays the events to work out how long each process spent running,
+ * waiting on a run queue and blocked, and how long woken processes waited
+ * before they got the CPU (wake-to-run latency), and counts how often each
+ * process had its priority raised by priority inheritance.
+ *
+ * Usage: traceview [-t] [tracefile]
+ *      -t  also print every process's timeline, one line per state change
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../trace.h"
+
+#define NUM_BUCKETS 32  // latency histogram buckets, one per power of two
+
+// process states while replaying
+#define UNKNOWN     0
+#define READY       1
+#define RUNNING     2
+#define BLOCKED     3
+#define DEAD        4
+
+/**
+ * What is known about one process while replaying the trace
+ */
+typedef struct Proc {
+    int seen;
+    int state;
+    int since;          // time the process entered state
+    int blockStatus;    // reason for the current block
+    int wokenAt;        // time the process was last made runnable, -1 if it was preempted instead
+
+    long long runTime;
+    long long waitTime;
+    long long blockTime;
+    int switches;       // times given the CPU
+    int wakeups;        // times made runnable by fork1() or a wakeup
+    int latencies;      // wakeups that were followed by a switch to this process
+    long long latencyTotal;
+    int latencyMax;
+    int boosts;         // times priority inheritance raised its priority
+} Proc;
+
+
+    /* ---------- Globals ---------- */
+
+Proc* procs;            // replay state, indexed by pid
+int numProcs;           // number of entries in procs
+int timeline;           // print a line per state change
+long long latencyHist[NUM_BUCKETS]; // wake-to-run latencies of every process, by power of two
+
+char* stateNames[] = { "unknown", "ready", "run", "blocked", "dead" };
+
+
+    /* ---------- Prototypes ---------- */
+
+Proc* getProc(int);
+void setState(int, int, int);
+void replay(TraceEvent*);
+void report(TraceHeader*, int, int);
+int bucketFor(int);
+
+
+    /* ---------- Functions ---------- */
+
+/**
+ * Purpose:
+ * Reads a trace file and prints the per process summary and the latency
+ * distribution
+ *
+ * Parameters:
+ * int argc     Number of command line arguments
+ * char** argv  Command line arguments
+ *
+ * Return:
+ * int  0 on success, 1 if the trace could not be read
+ */
+int main(int argc, char** argv) {
+    char* fileName = "phase1.trace";
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) { timeline = 1; }
+        else { fileName = argv[i]; }
+    }
+
+    FILE* file = fopen(fileName, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "traceview: cannot open %s\n", fileName);
+        return 1;
+    }
+
+    TraceHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC ||
+        header.version != TRACE_VERSION) {
+        fprintf(stderr, "traceview: %s is not a phase 1 trace\n", fileName);
+        return 1;
+    }
+
+    TraceEvent event;
+    int first = -1, last = 0;
+    for (int i = 0; i < header.count; i++) {
+        if (fread(&event, sizeof(event), 1, file) != 1) {
+            fprintf(stderr, "traceview: %s is truncated\n", fileName);
+            break;
+        }
+        if (first < 0) { first = event.time; }
+        last = event.time;
+        replay(&event);
+    }
+    fclose(file);
+
+    // close off whatever each process was doing when the trace ends
+    for (int pid = 0; pid < numProcs; pid++) {
+        if (procs[pid].seen && procs[pid].state != DEAD) {
+            setState(pid, procs[pid].state, last);
+        }
+    }
+
+    report(&header, first, last);
+    return 0;
+}
+
+/**
+ * Purpose:
+ * Returns the replay state of a process, growing the table if needed
+ *
+ * Parameters:
+ * int pid  PID of process
+ *
+ * Return:
+ * Proc*    Replay state of the process
+ */
+Proc* getProc(int pid) {
+    if (pid >= numProcs) {
+        int newSize = numProcs ? numProcs : 64;
+        while (newSize <= pid) { newSize *= 2; }
+        procs = realloc(procs, newSize * sizeof(Proc));
+        memset(&procs[numProcs], 0, (newSize - numProcs) * sizeof(Proc));
+        numProcs = newSize;
+    }
+    return &procs[pid];
+}
+
+/**
+ * Purpose:
+ * Moves a process to a new state, charging the time since its last change
+ * to the state it is leaving. A process first seen part way through the
+ * trace (because older events were dropped) starts with no history
+ *
+ * Parameters:
+ * int pid      PID of process
+ * int state    State the process is entering
+ * int time     Time of the change
+ *
+ * Return:
+ * None
+ */
+void setState(int pid, int state, int time) {
+    Proc* proc = getProc(pid);
+    if (!proc->seen) {
+        proc->seen = 1;
+        proc->wokenAt = -1;
+    }
+    else {
+        int elapsed = time - proc->since;
+        if (proc->state == RUNNING) { proc->runTime += elapsed; }
+        if (proc->state == READY) { proc->waitTime += elapsed; }
+        if (proc->state == BLOCKED) { proc->blockTime += elapsed; }
+
+        if (timeline && elapsed > 0 && proc->state != UNKNOWN) {
+            printf("%10d %10d  pid %4d  %-7s", proc->since, time, pid, stateNames[proc->state]);
+            if (proc->state == BLOCKED) { printf(" (status %d)", proc->blockStatus); }
+            printf("\n");
+        }
+    }
+    proc->state = state;
+    proc->since = time;
+}
+
+/**
+ * Purpose:
+ * Applies one trace event to the replay state
+ *
+ * Parameters:
+ * TraceEvent* event    Event to apply
+ *
+ * Return:
+ * None
+ */
+void replay(TraceEvent* event) {
+    Proc* proc;
+    switch (event->type) {
+        case TRACE_FORK:
+        case TRACE_UNBLOCK:
+            setState(event->pid, READY, event->time);
+            proc = getProc(event->pid);
+            proc->wokenAt = event->time;
+            proc->wakeups++;
+            break;
+
+        case TRACE_SWITCH:
+            // the old process was preempted unless it already blocked or quit
+            if (event->arg > 0 && getProc(event->arg)->state == RUNNING) {
+                setState(event->arg, READY, event->time);
+            }
+            setState(event->pid, RUNNING, event->time);
+            proc = getProc(event->pid);
+            proc->switches++;
+            if (proc->wokenAt >= 0) {
+                int latency = event->time - proc->wokenAt;
+                proc->latencies++;
+                proc->latencyTotal += latency;
+                if (latency > proc->latencyMax) { proc->latencyMax = latency; }
+                latencyHist[bucketFor(latency)]++;
+                proc->wokenAt = -1;
+            }
+            break;
+
+        case TRACE_BLOCK:
+            setState(event->pid, BLOCKED, event->time);
+            getProc(event->pid)->blockStatus = event->arg;
+            break;
+
+        case TRACE_QUIT:
+            setState(event->pid, DEAD, event->time);
+            break;
+
+        case TRACE_BOOST:
+        case TRACE_UNBOOST:
+            if (event->type == TRACE_BOOST) { getProc(event->pid)->boosts++; }
+            if (timeline) {
+                printf("%10d %10s  pid %4d  %s to priority %d\n", event->time, "", event->pid,
+                        event->type == TRACE_BOOST ? "boosted" : "restored", event->arg);
+            }
+            break;
+
+        // zap and join change no scheduling state; the block or quit
+        // that goes with them has its own event
+        default:
+            break;
+    }
+}
+
+/**
+ * Purpose:
+ * Returns the histogram bucket for a latency; bucket b holds latencies
+ * below 2^b microseconds (bucket 0 holds zero)
+ *
+ * Parameters:
+ * int latency  Latency in microseconds
+ *
+ * Return:
+ * int  Bucket index
+ */
+int bucketFor(int latency) {
+    int bucket = 0;
+    while (bucket < NUM_BUCKETS - 1 && latency >= (1 << bucket)) {
+        bucket++;
+    }
+    return bucket;
+}
+
+/**
+ * Purpose:
+ * Prints the per process summary and the wake-to-run latency histogram
+ *
+ * Parameters:
+ * TraceHeader* header  Header of the trace file
+ * int first            Time of the first event
+ * int last             Time of the last event
+ *
+ * Return:
+ * None
+ */
+void report(TraceHeader* header, int first, int last) {
+    printf("trace: %d events, %d dropped, %d us\n\n", header->count, header->dropped,
+            header->count ? last - first : 0);
+
+    printf(" pid     run(us)    wait(us)   block(us)  switches  wakeups  lat avg(us)  lat max(us)  boosts\n");
+    for (int pid = 0; pid < numProcs; pid++) {
+        Proc* proc = &procs[pid];
+        if (!proc->seen) { continue; }
+        int samples = proc->latencies ? proc->latencies : 1;
+        printf("%4d  %10lld  %10lld  %10lld  %8d  %7d  %11lld  %11d  %6d\n", pid, proc->runTime,
+                proc->waitTime, proc->blockTime, proc->switches, proc->wakeups,
+                proc->latencyTotal / samples, proc->latencyMax, proc->boosts);
+    }
+
+    long long total = 0;
+    int top = 0;
+    for (int b = 0; b < NUM_BUCKETS; b++) {
+        total += latencyHist[b];
+        if (latencyHist[b]) { top = b; }
+    }
+    if (total == 0) { return; }
+
+    printf("\nwake-to-run latency (us)\n");
+    for (int b = 0; b <= top; b++) {
+        int low = b ? 1 << (b - 1) : 0;
+        int high = b ? (1 << b) - 1 : 0;
+        printf("%8d - %-8d %8lld  ", low, high, latencyHist[b]);
+        for (int i = 0; i < 50 * latencyHist[b] / total; i++) { printf("#"); }
+        printf("\n");
+    }
+}
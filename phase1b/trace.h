@@ -0,0 +1,49 @@
+/**
+ * File: trace.h
+ * Authors: David McLain, Miles Gendreau
+ *
+ * Purpose: trace.h defines the binary format of the phase 1 scheduler
+ * event trace. The kernel keeps the most recent events in a ring buffer
+ * and writes them to a file when the simulation halts; traceview reads
+ * that file back on the host.
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#define TRACE_MAGIC     0x52543150  // "P1TR"
+#define TRACE_VERSION   1
+
+// event types
+#define TRACE_FORK      1   // pid forked; arg = parent pid
+#define TRACE_SWITCH    2   // pid given the CPU; arg = pid that had it (0 if none)
+#define TRACE_BLOCK     3   // pid blocked; arg = block status
+#define TRACE_UNBLOCK   4   // pid made runnable again; arg = pid that woke it
+#define TRACE_ZAP       5   // pid zapped; arg = pid doing the zapping
+#define TRACE_QUIT      6   // pid quit; arg = exit status
+#define TRACE_JOIN      7   // pid reaped by join(); arg = parent pid
+#define TRACE_BOOST     8   // pid's priority raised by a waiter; arg = new run priority
+#define TRACE_UNBOOST   9   // pid's inherited priority dropped; arg = new run priority
+
+/**
+ * Header at the start of a trace file, followed by count TraceEvents,
+ * oldest first
+ */
+typedef struct TraceHeader {
+    int magic;
+    int version;
+    int count;      // events in the file
+    int dropped;    // older events overwritten before the dump
+} TraceHeader;
+
+/**
+ * One scheduler event
+ */
+typedef struct TraceEvent {
+    int time;       // currentTime() when the event happened, in microseconds
+    int type;
+    int pid;
+    int arg;
+} TraceEvent;
+
+#endif
@@ -0,0 +1,104 @@
+/*
+ * Message slot allocator microbenchmark.
+ *
+ * start2() first parks a number of messages in a "ballast" mailbox, so that
+ * many of the MAXSLOTS message slots are already in use, then times a burst
+ * of MboxCondSend()s into a second mailbox followed by MboxCondRecv()s to
+ * empty it again.  Every send takes a free slot and every receive gives one
+ * back, so the rate shows how slot allocation cost changes as the slot
+ * pool fills up.  It then counts how many messages of a few sizes can be
+ * queued at once before sends start failing with -2; with PHASE2_SLOT_BYTES
+ * set, small messages take less of the slot arena, so more of them fit.
+ *
+ * Output is one line per occupancy level, in key=value form, so results
+ * can be compared across kernel changes.  BENCH_CLOCK, set by 'make bench',
+ * records whether USLOSS was run in real or (-R) virtual time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <usloss.h>
+#include <phase1.h>
+#include <phase2.h>
+#include <bench.h>
+
+#define BURST   64
+#define ROUNDS  2000
+
+static void runConfig(char *clockName, int occupied)
+{
+    int msg = 0;
+    int ballast = MboxCreate(MAXSLOTS, sizeof(int));
+    int mbox = MboxCreate(BURST, sizeof(int));
+    for (int i = 0; i < occupied; i++)
+        MboxCondSend(ballast, &msg, sizeof(int));
+
+    long sends = 0;
+    int simStart = currentTime();
+    double hostStart = hostSeconds();
+
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        for (int i = 0; i < BURST; i++)
+            sends += MboxCondSend(mbox, &msg, sizeof(int)) == 0;
+        for (int i = 0; i < BURST; i++)
+            MboxCondRecv(mbox, &msg, sizeof(int));
+    }
+
+    double hostElapsed = hostSeconds() - hostStart;
+    int simElapsed = currentTime() - simStart;
+
+    USLOSS_Console("BENCH slots clock=%s occupied=%d sends=%ld host_sec=%.3f sends_per_sec=%.0f sim_us=%d\n",
+                   clockName, occupied, sends, hostElapsed, sends / hostElapsed, simElapsed);
+
+    MboxRelease(mbox);
+    MboxRelease(ballast);
+}
+
+static void runCapacity(char *clockName, int size)
+{
+    char msg[MAX_MESSAGE] = { 0 };
+    int mboxes[MAXMBOX];
+    int numMboxes = 0;
+    long queued = 0;
+
+    for (;;)
+    {
+        mboxes[numMboxes] = MboxCreate(MAXSLOTS, size);
+        if (mboxes[numMboxes] < 0)
+            break;
+        int full = 0;
+        for (int i = 0; i < MAXSLOTS && !full; i++)
+        {
+            int result = MboxCondSend(mboxes[numMboxes], msg, size);
+            full = result == -2;
+            queued += result == 0;
+        }
+        numMboxes++;
+        if (full)
+            break;
+    }
+
+    USLOSS_Console("BENCH slot_capacity clock=%s msg_size=%d queued=%ld slot_bytes=%s\n",
+                   clockName, size, queued, getenv("PHASE2_SLOT_BYTES") ? getenv("PHASE2_SLOT_BYTES") : "0");
+
+    for (int i = 0; i < numMboxes; i++)
+        MboxRelease(mboxes[i]);
+}
+
+int start2(char *arg)
+{
+    char *clockName = getenv("BENCH_CLOCK") ? getenv("BENCH_CLOCK") : "unknown";
+
+    runConfig(clockName, 0);
+    runConfig(clockName, 500);
+    runConfig(clockName, 1000);
+    runConfig(clockName, 2000);
+    runConfig(clockName, MAXSLOTS - 2 * BURST);
+
+    runCapacity(clockName, 0);
+    runCapacity(clockName, sizeof(int));
+    runCapacity(clockName, 50);
+    runCapacity(clockName, MAX_MESSAGE);
+    return 0;
+}
@@ -13,19 +13,43 @@
  */
 #include <phase1.h>
 #include <phase2.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <usloss.h>
 
 #define CLOCK_INDEX 0
 #define TERM_INDEX USLOSS_CLOCK_UNITS
-#define DISK_INDEX TERM_INDEX + USLOSS_CLOCK_UNITS
+#define DISK_INDEX (TERM_INDEX + USLOSS_TERM_UNITS)
+#define NUM_DEVICES (DISK_INDEX + USLOSS_DISK_UNITS)
 
 #define AWAITING_DEVICE 1
 #define INVALID_SEND -1
 #define MAX_SLOTS_PASSED -2
 #define WAIT_RECV 20
 #define WAIT_SEND 21
+#define CLOCK_MSG_INTERVAL 100000
+#define WORD_BITS       (sizeof(unsigned long long) * CHAR_BIT)   // mailboxes per free bitmap word
+#define SUMMARY_BITS    (sizeof(unsigned int) * CHAR_BIT)   // free bitmap words the summary word can track
+#define MBOX_WORDS      ((MAXMBOX + WORD_BITS - 1) / WORD_BITS)   // words in the free mailbox bitmap
+#define GEN_WRAP        (1 << 20)   // generations an id can tell apart; MAXMBOX * GEN_WRAP must fit in an int
+#define NUM_SLOT_CLASSES 6
+#define SLOT_BLOCK(size) ((sizeof(Message) + (size) + 7) & ~7)  // bytes a slot of a size class takes
+#define SLOT_CHUNK      SLOT_BLOCK(MAX_MESSAGE)    // bytes in a chunk; one slot of the largest class
+
+// phase 1 calls an older libphase1.a may lack; each is NULL-checked before use
+#pragma weak registerProcExtension
+#pragma weak procExtension
+#pragma weak myProcExtension
+#pragma weak reschedule
+#pragma weak blockMeHandoff
+#pragma weak blockMeOn
+#pragma weak setWaitOwner
+#pragma weak requestTick
+#pragma weak queueKernelTask
+#pragma weak enterCpuMode
+#pragma weak leaveCpuMode
 
 /* ---------- Data Structures ----------*/
 
@@ -33,32 +57,51 @@ typedef struct PCB {
     char awaitingDevice;
     char hasMessage;
     char sentMessage;
-    char message[MAX_MESSAGE];
 
     int pid;
     int size;
+    int msgMax;         // room in msgBuffer while blocked receiving
+    char* msgBuffer;    // message being sent, or buffer for the message being received, while blocked
+    int handoffPid;     // consumer this proc just woke; gets the CPU if this proc's next mailbox call is a blocking recv
 
     struct PCB* nextConsumer;
     struct PCB* nextProducer;
 } PCB;
 
 typedef struct Message {
-    char inUse;
-    char message[MAX_MESSAGE];
-    
     int size;
 
     struct Message* nextSlot;
+
+    char message[];     // as many bytes as the size class of the slot's mailbox
 } Message;
 
+/**
+ * A SLOT_CHUNK sized piece of the slot arena, carved into slots of one size
+ * class while any of them are in use
+ */
+typedef struct SlotChunk {
+    int slotClass;
+    int live;           // slots handed out
+    int carved;         // slots carved off the chunk so far
+    Message* freeSlots; // carved slots given back, linked through nextSlot
+
+    struct SlotChunk* next;     // next chunk in partialChunks or unusedChunks
+    struct SlotChunk* prev;     // previous chunk in partialChunks
+} SlotChunk;
+
 typedef struct Mailbox {
     int id;
     int slotSize;
     int slots;
     int slotsInUse;
+    int slotClass;  // size class of the mailbox's message slots
 
     char isReleased;
     char inUse;
+    char isLock;    // set by MboxSetLock()
+
+    int holder;     // proc holding a lock mailbox, 0 if none does
 
     Message* messageHead;
     Message* messageTail;
@@ -73,35 +116,68 @@ typedef struct Mailbox {
 /* ---------- Globals ---------- */
 
 Mailbox mailboxes[MAXMBOX];     // all available mailboxes for IPC
-Message messageSlots[MAXSLOTS]; // all available message slots for all mailboxes
-PCB processes[MAXPROC];         // phantom process table, useful for queues
-
-int mboxID = 0;             // id of current open mailbox
+long long slotArena[MAXSLOTS * SLOT_CHUNK / sizeof(long long)]; // memory for all message slots, in chunks
+SlotChunk slotChunks[MAXSLOTS]; // state of each chunk of slotArena
+SlotChunk* partialChunks[NUM_SLOT_CLASSES]; // chunks of each size class with a slot to hand out
+SlotChunk* unusedChunks;        // chunks with no slots in use, linked through next
+int slotClassSizes[NUM_SLOT_CLASSES] = { 0, 8, 16, 32, 64, MAX_MESSAGE }; // message bytes of each size class
+PCB processes[MAXPROC];     // phantom process table, by pid % MAXPROC, for a phase 1 without PCB extensions
+int pcbExt = -1;            // handle of our block in each phase 1 PCB, -1 to use processes instead
+
+_Static_assert(MBOX_WORDS <= SUMMARY_BITS, "mboxFreeWords has too few bits for MAXMBOX");
+_Static_assert((long long) MAXMBOX * GEN_WRAP <= INT_MAX, "generation ids overflow an int");
+
+unsigned long long mboxFree[MBOX_WORDS]; // bit i % WORD_BITS of word i / WORD_BITS is set iff mailboxes[i] is free
+unsigned int mboxFreeWords; // bit w is set iff mboxFree[w] has a free mailbox
+int mboxGen[MAXMBOX];       // times each mailbox has been fully released
+int mboxGenerations = 0;    // PHASE2_MBOX_GENERATIONS: put the generation in mailbox ids
 int prevClockMsgTime = 0;   // last time a message was sent to the clock mailbox
 int slotsInUse = 0;         // counter for how many message slots are being used
+int slotBytes = 0;          // PHASE2_SLOT_BYTES: limit slots by arena space instead of MAXSLOTS
+int procsAwaitingDevice = 0; // counter for how many processes are in waitDevice()
+int deviceTaskCount = 0;    // counter for how many devices are handled by kernel tasks
+int inDevice = 0;           // nonzero while an interrupt handler or device task is sending
+int procsStarted = 0;       // nonzero once phase 1 is running processes
+
+void (*deviceTasks[NUM_DEVICES])(int, int); // kernel task handling each device's interrupts, by mailbox id
 
 void (*systemCallVec[MAXSYSCALLS])(USLOSS_Sysargs *args);
 
 
 /* ---------- Prototypes ----------*/
 
+int allocMboxIndex();
+int classFor(int);
+int deviceIndex(int, int);
 int disableInterrupts();
 int recvMessage(Mailbox*, char*, Message*);
 int validateSend(int, void*, int);
 int zeroSlotHelper(Mailbox*, char, char);
 
-Message* nextOpenSlot();
+void blockForMessage(int, int);
+void cancelHandoff();
+void wokeConsumer(int);
+
+Mailbox* findMbox(int);
+Message* allocSlot(int);
+PCB* getMyProc();
+PCB* getProc(int);
 
 void addToQueue(Mailbox*, char);
 void checkMode(char*);
 void diskAndTermHandler(int, void*);
+void freeMboxIndex(int);
+void freeSlot(Message*);
+void linkChunk(SlotChunk*);
 void nullsys(USLOSS_Sysargs*);
 void printMailboxes();
 void putInMailbox(Mailbox*, Message*);
 void restoreInterrupts(int);
+void runDeviceTask(int, int);
+void queueDeviceTask(int, int);
 void sendMessage(Mailbox*, char*, int);
-void setMboxID();
 void syscallHandler(int, void*);
+void unlinkChunk(SlotChunk*);
 
 /* ---------- Phase 2 Functions ----------*/
 
@@ -117,8 +193,34 @@ void syscallHandler(int, void*);
  */ 
 void phase2_init(void) {
     memset(mailboxes, 0, sizeof(mailboxes));
-    memset(messageSlots, 0, sizeof(messageSlots));
+    memset(slotChunks, 0, sizeof(slotChunks));
+    memset(partialChunks, 0, sizeof(partialChunks));
+    unusedChunks = NULL;
+    for (int i = MAXSLOTS - 1; i >= 0; i--) {
+        slotChunks[i].next = unusedChunks;
+        unusedChunks = &slotChunks[i];
+    }
+    slotsInUse = 0;
+    char* bytes = getenv("PHASE2_SLOT_BYTES");
+    slotBytes = bytes ? atoi(bytes) : 0;
+    memset(mboxFree, 0, sizeof(mboxFree));
+    mboxFreeWords = 0;
+    for (int i = MAXMBOX - 1; i >= 0; i--) {
+        freeMboxIndex(i);
+    }
+    memset(mboxGen, 0, sizeof(mboxGen));
+    char* generations = getenv("PHASE2_MBOX_GENERATIONS");
+    mboxGenerations = generations ? atoi(generations) : 0;
     memset(processes, 0, sizeof(processes));
+    memset(deviceTasks, 0, sizeof(deviceTasks));
+    pcbExt = -1;
+    if (registerProcExtension) {
+        pcbExt = registerProcExtension(sizeof(PCB));
+        if (pcbExt < 0) {
+            USLOSS_Console("ERROR: no room for phase 2 state in phase 1 PCBs\n");
+            USLOSS_Halt(1);
+        }
+    }
     for (int i = 0; i < MAXSYSCALLS; i++) {
         systemCallVec[i] = &nullsys;
     }
@@ -132,7 +234,9 @@ void phase2_init(void) {
 
 /**
  * Purpose:
- * None
+ * Notes that processes are running. No service processes are needed, but
+ * later phases' init functions send to mailboxes before this, when there
+ * is no current process to keep handoff state for
  * 
  * Parameters:
  * None
@@ -140,36 +244,41 @@ void phase2_init(void) {
  * Return:
  * None
  */ 
-void phase2_start_service_processes() {} // no-op, don't need any service procs here
+void phase2_start_service_processes() {
+    procsStarted = 1;
+}
 
 /**
  * Purpose:
  * Creates a new mailbox with the lowest possible mailbox id with a 
- * specified amount of slots, and specified size in bytes for each slot
+ * specified amount of slots, and specified size in bytes for each slot.
+ * With PHASE2_MBOX_GENERATIONS set the id also says how many times that
+ * mailbox has been released, so an old id can't reach its replacement
  * 
  * Parameters:
  * int slots        the amount of slots the mailbox will use
  * int slot_size    the size, in bytes, each slot will use
  *
  * Return:
- * int  id of the mailbox created
+ * int  id of the mailbox created, -1 if invalid args or no mailbox is free
  */ 
 int MboxCreate(int slots, int slot_size) {
     checkMode("MboxCreate");
     int prevInt = disableInterrupts();
 
-    if (slots < 0 || slot_size < 0 || slots > MAXSLOTS || mailboxes[mboxID].inUse || slot_size > MAX_MESSAGE) {
+    int index = -1;
+    if (slots < 0 || slot_size < 0 || slots > MAXSLOTS || slot_size > MAX_MESSAGE ||
+        (index = allocMboxIndex()) < 0) {
         restoreInterrupts(prevInt);
         return -1;
     }
-    Mailbox* cur = &mailboxes[mboxID];
-    cur->id = mboxID;
+    Mailbox* cur = &mailboxes[index];
+    cur->id = mboxGenerations ? index + MAXMBOX * (mboxGen[index] % GEN_WRAP) : index;
     cur->slots = slots;
     cur->slotSize = slot_size;
+    cur->slotClass = classFor(slot_size);
     cur->inUse = 1;
 
-    // move mboxID to next available index in mailboxes array
-    setMboxID();
     restoreInterrupts(prevInt);
     return cur->id;
 }
@@ -188,16 +297,30 @@ int MboxCreate(int slots, int slot_size) {
 int MboxRelease(int mbox_id) {
     checkMode("MboxRelease");
     int prevInt = disableInterrupts();
+    cancelHandoff();
 
-    if (!mailboxes[mbox_id].inUse || mailboxes[mbox_id].isReleased) {
+    Mailbox* mbox = findMbox(mbox_id);
+    if (mbox == NULL || !mbox->inUse || mbox->isReleased) {
         restoreInterrupts(prevInt);
         return -1;
     }
-    Mailbox* mbox = &mailboxes[mbox_id];
     mbox->isReleased = 1;
+
+    // nobody can receive the queued messages any more; give back their slots
+    while (mbox->messageHead) {
+        Message* msg = mbox->messageHead;
+        mbox->messageHead = msg->nextSlot;
+        freeSlot(msg);
+        slotsInUse--;
+    }
+    mbox->messageTail = NULL;
+    mbox->slotsInUse = 0;
+
     if (!mbox->consumerHead && !mbox->producerHead) {
+        int index = mbox - mailboxes;
         memset(mbox, 0, sizeof(Mailbox));
-        setMboxID();
+        mboxGen[index]++;
+        freeMboxIndex(index);
     }
     PCB* cur = mbox->consumerHead;
     while (cur) {
@@ -214,6 +337,34 @@ int MboxRelease(int mbox_id) {
     return 0;
 }
 
+/**
+ * Purpose:
+ * Marks a mailbox as a lock, such as a 1 slot mutex taken by receiving and
+ * given back by sending. Only for a lock does phase 2 know which process a
+ * blocked receiver is waiting on, so only then does that process inherit
+ * the receiver's priority
+ * 
+ * Parameters:
+ * int mbox_id  id of mailbox to mark
+ *
+ * Return:
+ * int  0 if successful, -1 if invalid args
+ */ 
+int MboxSetLock(int mbox_id) {
+    checkMode("MboxSetLock");
+    int prevInt = disableInterrupts();
+
+    Mailbox* mbox = findMbox(mbox_id);
+    if (mbox == NULL || !mbox->inUse || mbox->isReleased) {
+        restoreInterrupts(prevInt);
+        return -1;
+    }
+    mbox->isLock = 1;
+
+    restoreInterrupts(prevInt);
+    return 0;
+}
+
 /**
  * Purpose:
  * Sends a message through a mailbox. Message may be delivered directly to
@@ -231,6 +382,7 @@ int MboxRelease(int mbox_id) {
 int MboxSend(int mbox_id, void *msg_ptr, int msg_size) {
     checkMode("MboxSend");
     int prevInt = disableInterrupts();
+    cancelHandoff();
 
     // validate arguments for send
     int invalid = validateSend(mbox_id, msg_ptr, msg_size);
@@ -239,7 +391,7 @@ int MboxSend(int mbox_id, void *msg_ptr, int msg_size) {
         return invalid;
     }
 
-    Mailbox* curMbox = &mailboxes[mbox_id];
+    Mailbox* curMbox = findMbox(mbox_id);
 
     // handle zero slot mailbox
     if (!curMbox->slots) {
@@ -250,25 +402,24 @@ int MboxSend(int mbox_id, void *msg_ptr, int msg_size) {
 
     // add process to queue if queue is full
     if (curMbox->slotsInUse == curMbox->slots && curMbox->slots) {
-        PCB* temp = &processes[getpid() % MAXPROC];
-        memcpy(temp->message, msg_ptr, msg_size);
+        PCB* temp = getMyProc();
+        temp->msgBuffer = msg_ptr;
         temp->size = msg_size;
         addToQueue(curMbox, 0);
-        blockMe(WAIT_RECV);
-    }
+        blockForMessage(WAIT_RECV, 0);
 
-    // if mailbox released while blocked
-    if (curMbox->isReleased) {
-        restoreInterrupts(prevInt);
-        return -3;
-    }
-    
-    // if message was sent while blocked
-    PCB* temp = &processes[getpid() % MAXPROC];
-    if (temp->sentMessage) { 
-        temp->sentMessage = 0;
-        restoreInterrupts(prevInt);
-        return 0;
+        // if mailbox released while blocked
+        if (curMbox->isReleased) {
+            restoreInterrupts(prevInt);
+            return -3;
+        }
+
+        // if message was sent while blocked
+        if (temp->sentMessage) { 
+            temp->sentMessage = 0;
+            restoreInterrupts(prevInt);
+            return 0;
+        }
     }
 
     // send message as normal
@@ -297,12 +448,11 @@ int MboxRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
     int prevInt = disableInterrupts();
 
     // validate arguments for recv
-    if (mbox_id < 0 || mbox_id >= MAXMBOX) {
+    Mailbox* curMbox = findMbox(mbox_id);
+    if (curMbox == NULL) {
         restoreInterrupts(prevInt);
         return -1;
     }
-
-    Mailbox* curMbox = &mailboxes[mbox_id];
     if (curMbox->isReleased) {
         restoreInterrupts(prevInt);
         return -1;
@@ -317,8 +467,11 @@ int MboxRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
     // handle if no messages are available to recv
     Message* msg = curMbox->messageHead;
     if (msg == NULL) {
+        PCB* cur = getMyProc();
+        cur->msgBuffer = msg_ptr;
+        cur->msgMax = msg_max_size;
         addToQueue(curMbox, 1);
-        blockMe(WAIT_SEND);
+        blockForMessage(WAIT_SEND, curMbox->isLock ? curMbox->holder : 0);
     }
 
     // if mailbox was released while blocked
@@ -327,18 +480,13 @@ int MboxRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
         return -3;
     }
 
-    // if message was recv'd directly while blocked
-    PCB* cur = &processes[getpid() % MAXPROC];
+    // if message was recv'd directly while blocked; the sender already
+    // copied it into msg_ptr, unless it was too big
+    PCB* cur = getMyProc();
     if (cur->hasMessage) {
-        if (cur->size > msg_max_size) {
-            restoreInterrupts(prevInt);
-            return -1;
-        }
         cur->hasMessage = 0;
-
-        memcpy(msg_ptr, cur->message, msg_max_size);
         restoreInterrupts(prevInt);
-        return cur->size;
+        return cur->size > msg_max_size ? -1 : cur->size;
     }
 
     if (msg->size > msg_max_size) {
@@ -371,13 +519,14 @@ int MboxRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
 int MboxCondSend(int mbox_id, void *msg_ptr, int msg_size) {
     checkMode("MboxCondSend");
     int prevInt = disableInterrupts();
+    cancelHandoff();
     int invalid = validateSend(mbox_id, msg_ptr, msg_size);
     if (invalid) {
         restoreInterrupts(prevInt);
         return invalid;
     }
 
-    Mailbox* curMbox = &mailboxes[mbox_id];
+    Mailbox* curMbox = findMbox(mbox_id);
 
     if (!curMbox->slots) {
         int ret = zeroSlotHelper(curMbox, 1, 1);
@@ -412,10 +561,11 @@ int MboxCondSend(int mbox_id, void *msg_ptr, int msg_size) {
 int MboxCondRecv(int mbox_id, void *msg_ptr, int msg_max_size) {
     checkMode("MboxCondRecv");
     int prevInt = disableInterrupts();
+    cancelHandoff();
 
-    Mailbox* curMbox = &mailboxes[mbox_id];
+    Mailbox* curMbox = findMbox(mbox_id);
 
-    if (curMbox->isReleased) {
+    if (curMbox == NULL || curMbox->isReleased) {
         restoreInterrupts(prevInt);
         return -1;
     }
@@ -458,40 +608,32 @@ void waitDevice(int type, int unit, int *status) {
     checkMode("waitDevice");
     int prevInt = disableInterrupts();
     // find the correct mailbox
-    int devMboxID = -1; 
-    int devUnitErr = 0;
-    switch (type) {
-        case USLOSS_CLOCK_DEV:
-            devMboxID = CLOCK_INDEX;
-            if (unit >= USLOSS_CLOCK_UNITS) { devUnitErr = 1; }
-            break;
-        case USLOSS_TERM_DEV:
-            devMboxID = TERM_INDEX;
-            if (unit >= USLOSS_TERM_UNITS) { devUnitErr = 1; }
-            break;
-        case USLOSS_DISK_DEV:
-            devMboxID = DISK_INDEX;
-            if (unit >= USLOSS_DISK_UNITS) { devUnitErr = 1; }
-            break;
-        default:
-            USLOSS_Console("ERROR: Invalid device type\n");
-            USLOSS_Halt(1);
+    int devMboxID = deviceIndex(type, unit);
+    if (devMboxID == -1) {
+        USLOSS_Console("ERROR: Invalid device type\n");
+        USLOSS_Halt(1);
     }
-    
-    if (devUnitErr) {
+    if (devMboxID == -2) {
         USLOSS_Console("ERROR: Invalid device unit\n");
         USLOSS_Halt(1);
     }
 
     // set current proc's awaitingDevice flag
-    PCB* proc = &processes[getpid() % MAXPROC];
+    PCB* proc = getMyProc();
     proc->pid = getpid();
     proc->awaitingDevice = 1;
+    procsAwaitingDevice++;
+
+    // a tickless kernel has to be told when the next clock message is due
+    if (devMboxID == CLOCK_INDEX && requestTick) {
+        requestTick(prevClockMsgTime + CLOCK_MSG_INTERVAL);
+    }
 
     // call recv()
     int msg;
-    MboxRecv(devMboxID + unit, &msg, sizeof(int));
+    MboxRecv(devMboxID, &msg, sizeof(int));
     proc->awaitingDevice = 0;
+    procsAwaitingDevice--;
 
     // message is recieved, store it into status
     *status = msg;
@@ -514,21 +656,17 @@ int phase2_check_io() {
     checkMode("phase2_check_io");
     int prevInt = disableInterrupts();
 
-    for (int i = 0; i < MAXPROC; i++) {
-        if (processes[i].awaitingDevice) {
-            restoreInterrupts(prevInt);
-            return AWAITING_DEVICE;
-        }
-    }
+    // a device handled by a kernel task can always still wake someone
+    int ret = procsAwaitingDevice || deviceTaskCount ? AWAITING_DEVICE : 0;
 
     restoreInterrupts(prevInt);
-    return 0;
+    return ret;
 }
 
 /**
  * Purpose:
  * Sends a message to the mailbox for clock interrupts if more than 
- * 100 ms have passed
+ * 100 ms have passed, and queues the clock's kernel task if it has one
  * 
  * Parameters:
  * None
@@ -539,10 +677,23 @@ int phase2_check_io() {
 void phase2_clockHandler() {
     // only send a new message if 100 ms have passed since the last was sent
     int curTime = currentTime();
-    if (curTime < prevClockMsgTime + 100000) { return; }
+    if (curTime >= prevClockMsgTime + CLOCK_MSG_INTERVAL) {
+        // stamp the send first; the woken waiter may run before this returns
+        prevClockMsgTime = curTime;
+        if (deviceTasks[CLOCK_INDEX]) {
+            queueDeviceTask(CLOCK_INDEX, curTime);
+        }
+        inDevice++;
+        MboxCondSend(CLOCK_INDEX, &curTime, sizeof(int));
+        inDevice--;
+    }
 
-    MboxCondSend(CLOCK_INDEX, &curTime, sizeof(int));
-    prevClockMsgTime = curTime;
+    // a tickless kernel only calls back when asked, so keep asking while a
+    // process is still waiting for the next message; a clock task asks for
+    // the ticks it needs itself
+    if (mailboxes[CLOCK_INDEX].consumerHead && requestTick) {
+        requestTick(prevClockMsgTime + CLOCK_MSG_INTERVAL);
+    }
 }
 
 /**
@@ -565,8 +716,103 @@ void nullsys(USLOSS_Sysargs* args) {
  */
 void wakeupByDevice(int type, int unit, int status) {}
 
+/**
+ * Purpose:
+ * Makes a kernel task handle every interrupt from a device unit, in place
+ * of a driver process looping on waitDevice(). The task is called with the
+ * unit and the device status (the current time, for the clock) as soon as
+ * the interrupt has been taken, and must never block
+ * 
+ * Parameters:
+ * int type                 type of device
+ * int unit                 which unit of that device
+ * void (*task)(int, int)   task to queue for each interrupt
+ *
+ * Return:
+ * int  0 if the task was registered, -1 if the device is invalid or
+ *      phase 1 has no kernel tasks
+ */ 
+int registerDeviceTask(int type, int unit, void (*task)(int, int)) {
+    checkMode("registerDeviceTask");
+    int index = deviceIndex(type, unit);
+    if (index < 0 || task == NULL || !queueKernelTask) { return -1; }
+
+    int prevInt = disableInterrupts();
+    if (!deviceTasks[index]) { deviceTaskCount++; }
+    deviceTasks[index] = task;
+    restoreInterrupts(prevInt);
+    return 0;
+}
+
     /* ---------- Helper Functions ---------- */
 
+/**
+ * Purpose:
+ * Queues the kernel task for an interrupt from a unit with a registered
+ * device task. No driver process reads that unit's mailbox, so if the
+ * task queue is full the interrupt cannot be delivered at all; halt
+ * rather than lose it
+ * 
+ * Parameters:
+ * int index    deviceTasks slot (and mailbox id) of the unit
+ * int status   device status, or current time for the clock
+ *
+ * Return:
+ * None
+ */ 
+void queueDeviceTask(int index, int status) {
+    if (queueKernelTask(runDeviceTask, index, status) < 0) {
+        USLOSS_Console("ERROR: kernel task queue full, interrupt for device mailbox %d lost\n", index);
+        USLOSS_Halt(1);
+    }
+}
+
+/**
+ * Purpose:
+ * Kernel task queued for every interrupt from a unit with a registered
+ * device task; calls that task with the unit and status. Sends it makes
+ * wake consumers on behalf of the device, not of the interrupted process
+ * 
+ * Parameters:
+ * int index    deviceTasks slot (and mailbox id) of the unit
+ * int status   device status, or current time for the clock
+ *
+ * Return:
+ * None
+ */ 
+void runDeviceTask(int index, int status) {
+    int unit = index >= DISK_INDEX ? index - DISK_INDEX
+             : index >= TERM_INDEX ? index - TERM_INDEX : index - CLOCK_INDEX;
+    inDevice++;
+    deviceTasks[index](unit, status);
+    inDevice--;
+}
+
+/**
+ * Purpose:
+ * Finds the mailbox (and deviceTasks slot) for a device unit
+ * 
+ * Parameters:
+ * int type     type of device
+ * int unit     which unit of that device
+ *
+ * Return:
+ * int  mailbox id for the unit, -1 if the type is invalid, -2 if the
+ *      unit is invalid
+ */ 
+int deviceIndex(int type, int unit) {
+    switch (type) {
+        case USLOSS_CLOCK_DEV:
+            return unit >= 0 && unit < USLOSS_CLOCK_UNITS ? CLOCK_INDEX + unit : -2;
+        case USLOSS_TERM_DEV:
+            return unit >= 0 && unit < USLOSS_TERM_UNITS ? TERM_INDEX + unit : -2;
+        case USLOSS_DISK_DEV:
+            return unit >= 0 && unit < USLOSS_DISK_UNITS ? DISK_INDEX + unit : -2;
+        default:
+            return -1;
+    }
+}
+
 /**
  * Purpose:
  * Helper function for sending and receiving with a zero slot mailbox
@@ -585,12 +831,13 @@ int zeroSlotHelper(Mailbox* curMbox, char isSend, char isCond) {
         if (curMbox->consumerHead) {
             PCB* proc = curMbox->consumerHead;
             curMbox->consumerHead = curMbox->consumerHead->nextConsumer;
+            wokeConsumer(proc->pid);
             unblockProc(proc->pid);
         }
         else {
             if (isCond) { return -2; }
             addToQueue(curMbox, 0);
-            blockMe(WAIT_RECV);
+            blockForMessage(WAIT_RECV, 0);
         }
         return curMbox->isReleased ? -3 : 0;
     }
@@ -604,7 +851,7 @@ int zeroSlotHelper(Mailbox* curMbox, char isSend, char isCond) {
         else {
             if (isCond) { return -2; }
             addToQueue(curMbox, 1);
-            blockMe(WAIT_SEND);
+            blockForMessage(WAIT_SEND, 0);
         }
         return curMbox->isReleased ? -3 : 0;
     }
@@ -612,8 +859,28 @@ int zeroSlotHelper(Mailbox* curMbox, char isSend, char isCond) {
 
 /**
  * Purpose:
- * Sets mboxID to be the mailbox slot with the lowest value 
- * that is not in use
+ * Remembers that the current process just delivered a message to, and woke,
+ * a consumer. If the current process's next mailbox call is a recv that
+ * blocks (eg. a send followed by a recv for the reply), it hands the CPU
+ * straight to that consumer instead of going through the run queues. A
+ * send made by an interrupt handler or device task is not the interrupted
+ * process's, so it is not remembered
+ * 
+ * Parameters:
+ * int pid  pid of consumer that was woken
+ *
+ * Return:
+ * None
+ */ 
+void wokeConsumer(int pid) {
+    if (inDevice || !procsStarted) { return; }
+    getMyProc()->handoffPid = pid;
+}
+
+/**
+ * Purpose:
+ * Forgets the consumer the current process last woke, since whatever it
+ * does now is not the recv that a handoff is for
  * 
  * Parameters:
  * None
@@ -621,20 +888,102 @@ int zeroSlotHelper(Mailbox* curMbox, char isSend, char isCond) {
  * Return:
  * None
  */ 
-void setMboxID() {
-    Mailbox* temp = &mailboxes[mboxID];
-    for (int i = 0; i < MAXMBOX; i++) {
-        temp = &mailboxes[i];
-        if (!temp->inUse) { 
-            mboxID = i;
-            break;
-        }
+void cancelHandoff() {
+    if (!procsStarted) { return; }
+    getMyProc()->handoffPid = 0;
+}
+
+/**
+ * Purpose:
+ * Blocks the current process waiting on a mailbox, handing off to the
+ * consumer it last woke if there is one. Otherwise, if the mailbox is
+ * guarding a resource (a mutex or semaphore built on a mailbox), the
+ * process that holds it inherits the current process's priority until
+ * the current process is woken
+ * 
+ * Parameters:
+ * int blockStatus  reason for blocking (WAIT_RECV or WAIT_SEND)
+ * int owner        pid of process expected to wake us, or 0 if unknown
+ *
+ * Return:
+ * None
+ */ 
+void blockForMessage(int blockStatus, int owner) {
+    PCB* proc = getMyProc();
+    int target = proc->handoffPid;
+    proc->handoffPid = 0;
+
+    if (target && blockStatus == WAIT_SEND && blockMeHandoff) {
+        blockMeHandoff(blockStatus, target);
+    }
+    else if (owner && owner != getpid() && blockMeOn) {
+        blockMeOn(blockStatus, owner);
+    }
+    else {
+        blockMe(blockStatus);
     }
 }
 
 /**
  * Purpose:
- * Handles interrupt from disk and terminal
+ * Takes the lowest numbered free mailbox. The summary word says which
+ * bitmap words have a free mailbox, so this is two bit scans rather than
+ * a walk over the mailbox table
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * int  index of the mailbox in mailboxes, -1 if none are free
+ */ 
+int allocMboxIndex() {
+    if (!mboxFreeWords) { return -1; }
+    int word = __builtin_ctz(mboxFreeWords);
+    int bit = __builtin_ctzll(mboxFree[word]);
+    mboxFree[word] &= ~(1ULL << bit);
+    if (!mboxFree[word]) { mboxFreeWords &= ~(1U << word); }
+    return word * WORD_BITS + bit;
+}
+
+/**
+ * Purpose:
+ * Marks a mailbox as free in the free mailbox bitmap
+ * 
+ * Parameters:
+ * int index    index of the mailbox in mailboxes
+ *
+ * Return:
+ * None
+ */ 
+void freeMboxIndex(int index) {
+    mboxFree[index / WORD_BITS] |= 1ULL << (index % WORD_BITS);
+    mboxFreeWords |= 1U << (index / WORD_BITS);
+}
+
+/**
+ * Purpose:
+ * Finds the mailbox a mailbox id refers to. With generations on, the id
+ * of a mailbox that has since been released refers to nothing, even once
+ * its mailbox is handed out again
+ * 
+ * Parameters:
+ * int id   id of mailbox
+ *
+ * Return:
+ * Mailbox*     the mailbox, NULL if the id is out of range or stale
+ */ 
+Mailbox* findMbox(int id) {
+    if (id < 0) { return NULL; }
+    int index = id % MAXMBOX;
+    int gen = mboxGenerations ? mboxGen[index] % GEN_WRAP : 0;
+    if (id / MAXMBOX != gen) { return NULL; }
+    return &mailboxes[index];
+}
+
+/**
+ * Purpose:
+ * Handles interrupt from disk and terminal, passing the device status
+ * to the device's kernel task if it has one, or else its mailbox
  * 
  * Parameters:
  * int intType      type of interrupt received  
@@ -644,6 +993,7 @@ void setMboxID() {
  * None
  */ 
 void diskAndTermHandler(int intType, void* payload) {
+    int token = enterCpuMode ? enterCpuMode(CPU_INTERRUPT, intType) : 0;
     int devMboxID = -1; 
     switch (intType) {
         case USLOSS_DISK_INT:
@@ -660,7 +1010,21 @@ void diskAndTermHandler(int intType, void* payload) {
 
     int status;
     USLOSS_DeviceInput(intType, unit, &status);
-    MboxCondSend(devMboxID + unit, &status, sizeof(int));
+
+    // a device with a kernel task has no driver process waiting on it;
+    // the task runs before this interrupt returns to the dispatcher
+    if (deviceTasks[devMboxID + unit]) {
+        queueDeviceTask(devMboxID + unit, status);
+    }
+    else {
+        inDevice++;
+        MboxCondSend(devMboxID + unit, &status, sizeof(int));
+        inDevice--;
+    }
+
+    // run the task, or switch to the woken driver, now if it was deferred
+    if (reschedule) { reschedule(); }
+    if (leaveCpuMode) { leaveCpuMode(token); }
 }
 
 /**
@@ -682,17 +1046,29 @@ void sendMessage(Mailbox* curMbox, char* msg_ptr, int msg_size) {
     if (curMbox->consumerHead) {
         PCB* temp = curMbox->consumerHead;
         temp->size = msg_size;
-        memcpy(temp->message, msg_ptr, msg_size);
+        if (msg_size <= temp->msgMax) { memcpy(temp->msgBuffer, msg_ptr, msg_size); }
         temp->hasMessage = 1;
         curMbox->consumerHead = curMbox->consumerHead->nextConsumer;
+
+        // the woken consumer now holds the lock; everyone still waiting
+        // lends their priority to it instead
+        if (curMbox->isLock) { curMbox->holder = temp->pid; }
+        if (curMbox->isLock && setWaitOwner && temp != curMbox->consumerTail) {
+            for (PCB* cur = curMbox->consumerHead; ; cur = cur->nextConsumer) {
+                setWaitOwner(cur->pid, temp->pid);
+                if (cur == curMbox->consumerTail) { break; }
+            }
+        }
+        wokeConsumer(temp->pid);
         unblockProc(temp->pid);
         return;
     }
-    // queue message into slot if no consumer is waiting
-    Message* msg = nextOpenSlot();
+    // queue message into slot if no consumer is waiting; sending to a lock
+    // releases it
+    curMbox->holder = 0;
+    Message* msg = allocSlot(curMbox->slotClass);
     memcpy(msg->message, msg_ptr, msg_size);
     msg->size = msg_size;
-    msg->inUse = 1;
     putInMailbox(curMbox, msg);
     curMbox->slotsInUse++;
     slotsInUse++;
@@ -715,10 +1091,11 @@ void sendMessage(Mailbox* curMbox, char* msg_ptr, int msg_size) {
  */ 
 int recvMessage(Mailbox* curMbox, char* msg_ptr, Message* msg) {
     // recv a message through queue
+    if (curMbox->isLock) { curMbox->holder = getpid(); }
     curMbox->messageHead = curMbox->messageHead->nextSlot;
     memcpy(msg_ptr, msg->message, msg->size);
     int ret = msg->size;
-    memset(msg, 0, sizeof(Message));
+    freeSlot(msg);
     curMbox->slotsInUse--;
     slotsInUse--;
 
@@ -726,10 +1103,9 @@ int recvMessage(Mailbox* curMbox, char* msg_ptr, Message* msg) {
     if (curMbox->producerHead) {
         PCB* toUnblock = curMbox->producerHead;
         curMbox->producerHead = curMbox->producerHead->nextProducer;
-        Message* msg = nextOpenSlot();
+        Message* msg = allocSlot(curMbox->slotClass);
         msg->size = toUnblock->size;
-        msg->inUse = 1;
-        memcpy(msg->message, toUnblock->message, toUnblock->size);
+        memcpy(msg->message, toUnblock->msgBuffer, toUnblock->size);
         putInMailbox(curMbox, msg);
         toUnblock->sentMessage = 1;
         curMbox->slotsInUse++;
@@ -752,11 +1128,16 @@ int recvMessage(Mailbox* curMbox, char* msg_ptr, Message* msg) {
  * int  if arguments are valid 0, else error code associated with issue
  */ 
 int validateSend(int id, void* msg, int size) {
-    if (mailboxes[id].isReleased || id >= MAXMBOX || !mailboxes[id].inUse ||
-        size > mailboxes[id].slotSize) {
+    Mailbox* mbox = findMbox(id);
+    if (mbox == NULL || mbox->isReleased || !mbox->inUse || size > mbox->slotSize) {
         return INVALID_SEND;
     }
-    if (slotsInUse >= MAXSLOTS) {
+    // with PHASE2_SLOT_BYTES the limit is the arena itself: a slot of the
+    // mailbox's size class fits if a chunk of that class or an unused chunk
+    // has room. Otherwise at most MAXSLOTS messages are queued, whatever
+    // their size; each pins at most one chunk, so there is always room
+    int full = slotBytes ? !partialChunks[mbox->slotClass] && !unusedChunks : slotsInUse >= MAXSLOTS;
+    if (full) {
         return MAX_SLOTS_PASSED;
     }
     return 0;
@@ -764,21 +1145,147 @@ int validateSend(int id, void* msg, int size) {
 
 /**
  * Purpose:
- * Finds next open message slot and returns pointer to it
+ * Returns the smallest slot size class that holds messages of a given size
  * 
  * Parameters:
- * None
+ * int size     largest message the slots must hold
  *
  * Return:
- * Message*     pointer to next message slot that is available
+ * int  index of the size class in slotClassSizes
  */ 
-Message* nextOpenSlot() {
-    for (int i = 0; i < MAXSLOTS; i++) {
-        if (!messageSlots[i].inUse) {
-            return &messageSlots[i];
-        }
+int classFor(int size) {
+    int slotClass = 0;
+    while (slotClassSizes[slotClass] < size) { slotClass++; }
+    return slotClass;
+}
+
+/**
+ * Purpose:
+ * Takes a message slot of a size class, from a chunk already carved into
+ * that class if one has room and from an unused chunk otherwise. Callers
+ * check validateSend() first, so there is always room here
+ * 
+ * Parameters:
+ * int slotClass    size class of the slot
+ *
+ * Return:
+ * Message*     pointer to a message slot that is available
+ */ 
+Message* allocSlot(int slotClass) {
+    SlotChunk* chunk = partialChunks[slotClass];
+    if (!chunk) {
+        chunk = unusedChunks;
+        unusedChunks = chunk->next;
+        chunk->slotClass = slotClass;
+        chunk->carved = 0;
+        chunk->freeSlots = NULL;
+        linkChunk(chunk);
+    }
+
+    Message* msg = chunk->freeSlots;
+    int blockSize = SLOT_BLOCK(slotClassSizes[slotClass]);
+    if (msg) { chunk->freeSlots = msg->nextSlot; }
+    else { msg = (Message*)((char*)slotArena + (chunk - slotChunks) * SLOT_CHUNK + chunk->carved++ * blockSize); }
+    chunk->live++;
+
+    // a full chunk has nothing left to hand out until a slot comes back
+    if (!chunk->freeSlots && chunk->carved == SLOT_CHUNK / blockSize) { unlinkChunk(chunk); }
+    msg->nextSlot = NULL;
+    return msg;
+}
+
+/**
+ * Purpose:
+ * Gives a message slot back to its chunk. A chunk with no slots left in use
+ * goes back to the unused chunks, to be carved into whatever size class
+ * needs it next. The slot's contents are left as they are; the next sender
+ * overwrites them
+ * 
+ * Parameters:
+ * Message* msg     slot to free
+ *
+ * Return:
+ * None
+ */ 
+void freeSlot(Message* msg) {
+    SlotChunk* chunk = &slotChunks[((char*)msg - (char*)slotArena) / SLOT_CHUNK];
+    int wasFull = !chunk->freeSlots && chunk->carved == SLOT_CHUNK / SLOT_BLOCK(slotClassSizes[chunk->slotClass]);
+    msg->nextSlot = chunk->freeSlots;
+    chunk->freeSlots = msg;
+    chunk->live--;
+
+    if (!chunk->live) {
+        if (!wasFull) { unlinkChunk(chunk); }
+        chunk->next = unusedChunks;
+        unusedChunks = chunk;
     }
-    return NULL;
+    else if (wasFull) { linkChunk(chunk); }
+}
+
+/**
+ * Purpose:
+ * Adds a chunk to the front of the chunks of its size class that have a
+ * slot to hand out
+ * 
+ * Parameters:
+ * SlotChunk* chunk     chunk to add
+ *
+ * Return:
+ * None
+ */ 
+void linkChunk(SlotChunk* chunk) {
+    chunk->prev = NULL;
+    chunk->next = partialChunks[chunk->slotClass];
+    if (chunk->next) { chunk->next->prev = chunk; }
+    partialChunks[chunk->slotClass] = chunk;
+}
+
+/**
+ * Purpose:
+ * Removes a chunk from the chunks of its size class that have a slot to
+ * hand out
+ * 
+ * Parameters:
+ * SlotChunk* chunk     chunk to remove
+ *
+ * Return:
+ * None
+ */ 
+void unlinkChunk(SlotChunk* chunk) {
+    if (chunk->prev) { chunk->prev->next = chunk->next; }
+    else { partialChunks[chunk->slotClass] = chunk->next; }
+    if (chunk->next) { chunk->next->prev = chunk->prev; }
+}
+
+/**
+ * Purpose:
+ * Finds the phase 2 state of the current process
+ * 
+ * Parameters:
+ * None
+ *
+ * Return:
+ * PCB*     phase 2 state of the current process
+ */ 
+PCB* getMyProc() {
+    if (pcbExt >= 0) { return myProcExtension(pcbExt); }
+    return getProc(getpid());
+}
+
+/**
+ * Purpose:
+ * Finds the phase 2 state of a process, kept in its phase 1 PCB, or in
+ * the phantom process table with a phase 1 that has no PCB extensions
+ * 
+ * Parameters:
+ * int pid  pid of process to find entry for
+ *
+ * Return:
+ * PCB*     phase 2 state of the process
+ */ 
+PCB* getProc(int pid) {
+    if (pcbExt >= 0) { return procExtension(pid, pcbExt); }
+    return &processes[pid % MAXPROC];
 }
 
 /**
@@ -816,7 +1323,7 @@ void putInMailbox(Mailbox* mbox, Message* msg) {
  * None
  */ 
 void addToQueue(Mailbox* mbox, char isConsumer) {
-    PCB* proc = &processes[getpid() % MAXPROC];
+    PCB* proc = getMyProc();
     proc->pid = getpid();
     // handle if we are adding to consumer queue
     if (isConsumer) {
@@ -854,12 +1361,16 @@ void addToQueue(Mailbox* mbox, char isConsumer) {
  * None
  */ 
 void syscallHandler(int dev, void* arg) {
+    int token = enterCpuMode ? enterCpuMode(CPU_KERNEL, USLOSS_SYSCALL_INT) : 0;
     USLOSS_Sysargs* args = (USLOSS_Sysargs*)arg;
     if (args->number < 0 || args->number >= MAXSYSCALLS) {
         USLOSS_Console("syscallHandler(): Invalid syscall number %d\n", args->number);
         USLOSS_Halt(1);
     }
-    (*systemCallVec)(args);
+    (*systemCallVec[args->number])(args);
+    cancelHandoff();
+    if (reschedule) { reschedule(); }
+    if (leaveCpuMode) { leaveCpuMode(token); }
 }
 
 /**
@@ -909,4 +1420,7 @@ int disableInterrupts() {
  */ 
 void restoreInterrupts(int prevInt) {
     USLOSS_PsrSet(USLOSS_PsrGet() | prevInt);
+
+    // run any dispatch phase 1 deferred while interrupts were off
+    if (prevInt && reschedule) { reschedule(); }
 }
@@ -36,11 +36,21 @@ extern int MboxCondSend(int mbox_id, void *msg_ptr, int msg_size);
 // returns 0 if successful, 1 if no msg available, -1 if illegal args
 extern int MboxCondRecv(int mbox_id, void *msg_ptr, int msg_max_size);
 
+// marks a mailbox as a lock: a process that receives from it holds it until
+// the next send, and processes blocked receiving lend it their priority;
+// returns 0 if successful, -1 if invalid args
+extern int MboxSetLock(int mbox_id);
+
 // type = interrupt device type, unit = # of device (when more than one),
 // status = where interrupt handler puts device's status register.
 extern void     waitDevice(int type, int unit, int *status);
 extern void wakeupByDevice(int type, int unit, int status);
 
+// has task(unit, status) run as a kernel task for every interrupt from the
+// device unit, in place of a driver process in waitDevice(); returns 0 if
+// successful, -1 if invalid args or phase 1 has no kernel tasks
+extern int registerDeviceTask(int type, int unit, void (*task)(int unit, int status));
+
 // 
 extern void (*systemCallVec[])(USLOSS_Sysargs *args);
 
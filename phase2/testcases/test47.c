@@ -0,0 +1,92 @@
+/* Tests that a mailbox marked with MboxSetLock() lends a waiter's priority
+ * to the process holding it
+ *
+ * start2 creates a one-slot lock mailbox holding one message, marks it as
+ * a lock, and creates Low at priority 5.  Low takes the lock with a
+ * MboxRecv(), then creates High at priority 1.  High creates Medium at
+ * priority 3, then blocks trying to take the lock.
+ *
+ * When phase 1 has priority inheritance (blockMeOn()), Low runs at High's
+ * priority until it puts the lock back, so Low and High finish before
+ * Medium runs.  Without it, Medium runs while High waits on Low.
+ */
+
+#include <phase1.h>
+#include <phase2.h>
+#include <usloss.h>
+#include <stdio.h>
+
+#pragma weak blockMeOn
+
+int Low(char *);
+int High(char *);
+int Medium(char *);
+
+int lock;
+
+
+
+int start2(char *arg)
+{
+    int kidPid, status;
+
+    USLOSS_Console("start2(): started.  Creating lock mailbox.\n");
+    if (blockMeOn) {
+        USLOSS_Console("start2(): phase 1 has priority inheritance, so Medium should run last\n");
+    }
+    else {
+        USLOSS_Console("start2(): phase 1 has no priority inheritance, so Medium should run first\n");
+    }
+
+    lock = MboxCreate(1, 0);
+    MboxSend(lock, NULL, 0);
+    USLOSS_Console("start2(): MboxSetLock() returned %d\n", MboxSetLock(lock));
+
+    fork1("Low", Low, NULL, USLOSS_MIN_STACK, 5);
+
+    kidPid = join(&status);
+    USLOSS_Console("Process %d joined with status: %d\n", kidPid, status);
+
+    quit(0);
+}
+
+int Low(char *arg)
+{
+    int kidPid, status;
+
+    MboxRecv(lock, NULL, 0);
+    USLOSS_Console("Low(): holding the lock\n");
+
+    fork1("High", High, NULL, USLOSS_MIN_STACK, 1);
+
+    USLOSS_Console("Low(): releasing the lock\n");
+    MboxSend(lock, NULL, 0);
+
+    kidPid = join(&status);
+    USLOSS_Console("Process %d joined with status: %d\n", kidPid, status);
+
+    quit(5);
+}
+
+int High(char *arg)
+{
+    int kidPid, status;
+
+    fork1("Medium", Medium, NULL, USLOSS_MIN_STACK, 3);
+
+    USLOSS_Console("High(): taking the lock\n");
+    MboxRecv(lock, NULL, 0);
+    USLOSS_Console("High(): took the lock\n");
+    MboxSend(lock, NULL, 0);
+
+    kidPid = join(&status);
+    USLOSS_Console("Process %d joined with status: %d\n", kidPid, status);
+
+    quit(1);
+}
+
+int Medium(char *arg)
+{
+    USLOSS_Console("Medium(): ran\n");
+    quit(3);
+}
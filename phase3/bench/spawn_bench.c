@@ -0,0 +1,64 @@
+/*
+ * Spawn/Wait microbenchmark.
+ *
+ * start3() runs in user mode and repeatedly Spawn()s a child that returns
+ * at once, then Wait()s for it, so every round is two system calls, a
+ * process created and torn down, and the trampoline back into user mode.
+ * It is run with the child at a higher priority than start3() (the child
+ * runs inside Spawn()) and at a lower one (the child runs inside Wait()).
+ *
+ * Output is one line per configuration, in key=value form, so results can
+ * be compared across kernel changes.  sim_us is USLOSS time, so it only
+ * means CPU time when the benchmark is run with -R (virtual time); the
+ * BENCH_CLOCK environment variable, set by 'make bench', records which
+ * clock was used.
+ */
+
+#include <usloss.h>
+#include <usyscall.h>
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3_usermode.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <bench.h>
+
+#define ROUNDS  2000
+
+int child(char *);
+
+static void benchSpawnWait(char *clockName, int priority)
+{
+    int pid, status, simStart, simEnd;
+
+    GetTimeofDay(&simStart);
+    double hostStart = hostSeconds();
+
+    for (int r = 0; r < ROUNDS; r++)
+    {
+        Spawn("child", child, NULL, USLOSS_MIN_STACK, priority, &pid);
+        Wait(&pid, &status);
+    }
+
+    double hostElapsed = hostSeconds() - hostStart;
+    GetTimeofDay(&simEnd);
+
+    USLOSS_Console("BENCH spawn_wait clock=%s child_priority=%d rounds=%d host_sec=%.3f rounds_per_sec=%.0f host_ns_per_round=%.0f sim_us=%d sim_us_per_round=%.2f\n",
+                   clockName, priority, ROUNDS, hostElapsed, ROUNDS / hostElapsed,
+                   hostElapsed * 1e9 / ROUNDS, simEnd - simStart, (double)(simEnd - simStart) / ROUNDS);
+}
+
+int start3(char *arg)
+{
+    char *clockName = getenv("BENCH_CLOCK") ? getenv("BENCH_CLOCK") : "unknown";
+
+    benchSpawnWait(clockName, 2);
+    benchSpawnWait(clockName, 4);
+
+    Terminate(0);
+}
+
+int child(char *arg)
+{
+    return 0;
+}
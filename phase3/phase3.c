@@ -11,11 +11,19 @@
 #include <phase2.h>
 #include <phase3.h>
 #include <phase3_usermode.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <usloss.h>
 
 #define USER_MODE 0x02
 
+// getProcStats, setRealTime, yieldTo and MboxSetLock are NULL in older kernels
+#pragma weak getProcStats
+#pragma weak setRealTime
+#pragma weak yieldTo
+#pragma weak MboxSetLock
+
 /* ---------- Data Structures ---------- */
 
 typedef struct Process {
@@ -31,16 +39,21 @@ void kernelTerminate(USLOSS_Sysargs*);
 void kernelSemCreate(USLOSS_Sysargs*);
 void kernelSemP(USLOSS_Sysargs*);
 void kernelSemV(USLOSS_Sysargs*);
+void kernelLockCreate(USLOSS_Sysargs*);
 void kernelGetTimeOfDay(USLOSS_Sysargs*);
-void kernelCPUTime(USLOSS_Sysargs*);
+void kernelGetProcInfo(USLOSS_Sysargs*);
+void kernelSetRealTime(USLOSS_Sysargs*);
+void kernelYieldTo(USLOSS_Sysargs*);
 void kernelGetPid(USLOSS_Sysargs*);
 
 int trampoline(char*);
+int createSem(int);
 
 /* ---------- Globals ---------- */
 
 int totalSems = 0;              // num. of semaphores currently allocated
 int semaphoreTable[MAXSEMS];    // all available semaphore slots
+char spawnArgs[MAXMBOX][12];    // mailbox id passed to each spawning trampoline, by mailbox
 
 /* ---------- Phase 3 Functions ---------- */
 
@@ -64,8 +77,13 @@ void phase3_init(void) {
     systemCallVec[SYS_SEMCREATE] = kernelSemCreate;
     systemCallVec[SYS_SEMP] = kernelSemP;
     systemCallVec[SYS_SEMV] = kernelSemV;
+    systemCallVec[SYS_LOCKCREATE] = kernelLockCreate;
+    systemCallVec[SYS_LOCKACQUIRE] = kernelSemP;
+    systemCallVec[SYS_LOCKRELEASE] = kernelSemV;
     systemCallVec[SYS_GETTIMEOFDAY] = kernelGetTimeOfDay;
-    systemCallVec[SYS_GETPROCINFO] = kernelCPUTime;
+    systemCallVec[SYS_GETPROCINFO] = kernelGetProcInfo;
+    systemCallVec[SYS_SETREALTIME] = kernelSetRealTime;
+    systemCallVec[SYS_YIELDTO] = kernelYieldTo;
     systemCallVec[SYS_GETPID] = kernelGetPid;
 }
 
@@ -81,6 +99,31 @@ void phase3_init(void) {
  */
 void phase3_start_service_processes() {}
 
+/* ---------- Helper Functions ---------- */
+
+/**
+ * Purpose:
+ * Allocate a semaphore (a mailbox holding its value) in the semaphore table.
+ *
+ * Parameters:
+ * int initialValue     value the semaphore starts at
+ *
+ * Return:
+ * int  id of the new semaphore, or -1 if the table is full or the value
+ *      is negative
+ */
+int createSem(int initialValue) {
+    if (totalSems == MAXSEMS || initialValue < 0) {
+        return -1;
+    }
+
+    semaphoreTable[totalSems] = MboxCreate(1, sizeof(int));
+    if (initialValue > 0) {
+        MboxSend(semaphoreTable[totalSems], &initialValue, sizeof(int));
+    }
+    return totalSems++;
+}
+
 /* ---------- Syscall Handlers ---------- */
 
 /**
@@ -101,7 +144,11 @@ void kernelSpawn(USLOSS_Sysargs* args) {
     cur.args = args->arg2;
     MboxSend(mbox, (void*)&cur, sizeof(Process));
     
-    int pid = fork1((char*)args->arg5, trampoline, (char*)(long)mbox, (int)(long)args->arg3, (int)(long)args->arg4);
+    // fork1() may copy its argument as a string or keep the pointer, so
+    // pass the mailbox id as a string that lasts until the child reads it
+    char* mboxArg = spawnArgs[mbox % MAXMBOX];
+    sprintf(mboxArg, "%d", mbox);
+    int pid = fork1((char*)args->arg5, trampoline, mboxArg, (int)(long)args->arg3, (int)(long)args->arg4);
     if (pid < 0) {
         args->arg4 = (void*)(long)-1;
         return;
@@ -121,7 +168,7 @@ void kernelSpawn(USLOSS_Sysargs* args) {
  * Return:
  */
 int trampoline(char* args) {
-    int mbox = (int)(long)(void*)args;
+    int mbox = atoi(args);
     Process cur;
     MboxRecv(mbox, &cur, sizeof(Process));
     MboxRelease(mbox);
@@ -188,18 +235,40 @@ void kernelTerminate(USLOSS_Sysargs* args) {
  * None
  */
 void kernelSemCreate(USLOSS_Sysargs* args) {
-    int initialValue = (int)(long)args->arg1;
-    if (totalSems == MAXSEMS || initialValue < 0) {
+    int semId = createSem((int)(long)args->arg1);
+    if (semId < 0) {
         args->arg4 = (void*)(long)-1;
         return;
     }
 
-    semaphoreTable[totalSems] = MboxCreate(1, sizeof(int));
-    if (initialValue > 0) {
-        MboxSend(semaphoreTable[totalSems], &initialValue, sizeof(int));
+    args->arg1 = (void*)(long)semId;
+    args->arg4 = NULL;
+}
+
+/**
+ * Purpose:
+ * Create a new lock: a semaphore that starts at 1 and is owned by whoever
+ * acquired it last, so processes waiting to acquire it lend that owner
+ * their priority. Locks are acquired and released with the semaphore P
+ * and V handlers. Store the lock's id in an out parameter.
+ *
+ * Parameters:
+ * USLOSS_Sysargs* args     arguments and out parameters for this system call
+ *
+ * Return:
+ * None
+ */
+void kernelLockCreate(USLOSS_Sysargs* args) {
+    int lockId = createSem(1);
+    if (lockId < 0) {
+        args->arg4 = (void*)(long)-1;
+        return;
+    }
+    if (MboxSetLock) {
+        MboxSetLock(semaphoreTable[lockId]);
     }
 
-    args->arg1 = (void*)(long)totalSems++;
+    args->arg1 = (void*)(long)lockId;
     args->arg4 = NULL;
 }
 
@@ -273,7 +342,10 @@ void kernelGetTimeOfDay(USLOSS_Sysargs* args) {
 
 /**
  * Purpose:
- * Get the total time the current process has taken on the CPU in microseconds.
+ * Get scheduling statistics for a process. With no stats buffer (CPUTime())
+ * only the total time the current process has taken on the CPU, in
+ * microseconds, is returned. Otherwise the full ProcStats record for the
+ * given pid (0 for the current process) is copied into the buffer.
  *
  * Parameters:
  * USLOSS_Sysargs* args     arguments and out parameters for this system call
@@ -281,8 +353,70 @@ void kernelGetTimeOfDay(USLOSS_Sysargs* args) {
  * Return:
  * None
  */
-void kernelCPUTime(USLOSS_Sysargs* args) {
+void kernelGetProcInfo(USLOSS_Sysargs* args) {
+    int pid = (int)(long)args->arg1 ? (int)(long)args->arg1 : getpid();
     args->arg1 = (void*)(long)readtime();
+
+    ProcStats* stats = args->arg2;
+    if (stats == NULL) { return; }
+
+    if (getProcStats == NULL) {
+        if (pid != getpid()) {
+            args->arg4 = (void*)(long)-1;
+            return;
+        }
+        memset(stats, 0, sizeof(ProcStats));
+        stats->pid = pid;
+        stats->cpuTime = readtime();
+        args->arg4 = NULL;
+        return;
+    }
+    args->arg4 = (void*)(long)getProcStats(pid, stats);
+}
+
+/**
+ * Purpose:
+ * Put a process (0 for the current process) in the earliest-deadline-first
+ * scheduling class with the given period and budget, or take it out of the
+ * class with a budget of 0.
+ *
+ * Parameters:
+ * USLOSS_Sysargs* args     arguments and out parameters for this system call
+ *
+ * Return:
+ * None
+ */
+void kernelSetRealTime(USLOSS_Sysargs* args) {
+    int pid = (int)(long)args->arg1 ? (int)(long)args->arg1 : getpid();
+    int period = (int)(long)args->arg2;
+    int budget = (int)(long)args->arg3;
+
+    if (setRealTime == NULL) {
+        args->arg4 = (void*)(long)-1;
+        return;
+    }
+    args->arg4 = (void*)(long)setRealTime(pid, period, budget);
+}
+
+/**
+ * Purpose:
+ * Give up the CPU to another process (0 for whichever is next), sending
+ * the caller to the back of its run queue.
+ *
+ * Parameters:
+ * USLOSS_Sysargs* args     arguments and out parameters for this system call
+ *
+ * Return:
+ * None
+ */
+void kernelYieldTo(USLOSS_Sysargs* args) {
+    int pid = (int)(long)args->arg1;
+
+    if (yieldTo == NULL) {
+        args->arg4 = (void*)(long)-1;
+        return;
+    }
+    args->arg4 = (void*)(long)yieldTo(pid);
 }
 
 /**
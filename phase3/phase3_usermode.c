@@ -109,6 +109,57 @@ void CPUTime(int *cpu)
 
 
 
+int GetProcInfo(int pid, ProcStats *stats)
+{
+    require_user_mode(__func__);
+
+    USLOSS_Sysargs args;
+    memset(&args, 0, sizeof(args));
+
+    args.number = SYS_GETPROCINFO;
+    args.arg1   = (void*)(long)pid;
+    args.arg2   = stats;
+    USLOSS_Syscall(&args);
+
+    return (int)(long)args.arg4;
+}
+
+
+
+int SetRealTime(int pid, int period, int budget)
+{
+    require_user_mode(__func__);
+
+    USLOSS_Sysargs args;
+    memset(&args, 0, sizeof(args));
+
+    args.number = SYS_SETREALTIME;
+    args.arg1   = (void*)(long)pid;
+    args.arg2   = (void*)(long)period;
+    args.arg3   = (void*)(long)budget;
+    USLOSS_Syscall(&args);
+
+    return (int)(long)args.arg4;
+}
+
+
+
+int YieldTo(int pid)
+{
+    require_user_mode(__func__);
+
+    USLOSS_Sysargs args;
+    memset(&args, 0, sizeof(args));
+
+    args.number = SYS_YIELDTO;
+    args.arg1   = (void*)(long)pid;
+    USLOSS_Syscall(&args);
+
+    return (int)(long)args.arg4;
+}
+
+
+
 void GetPID(int *pid)
 {
     require_user_mode(__func__);
@@ -173,6 +224,54 @@ int SemV(int semaphore)
 
 
 
+int LockCreate(int *lock)
+{
+    require_user_mode(__func__);
+
+    USLOSS_Sysargs args;
+    memset(&args, 0, sizeof(args));
+
+    args.number = SYS_LOCKCREATE;
+    USLOSS_Syscall(&args);
+
+    *lock = (int)(long)args.arg1;
+    return  (int)(long)args.arg4;
+}
+
+
+
+int LockAcquire(int lock)
+{
+    require_user_mode(__func__);
+
+    USLOSS_Sysargs args;
+    memset(&args, 0, sizeof(args));
+
+    args.number = SYS_LOCKACQUIRE;
+    args.arg1 = (void*)(long)lock;
+    USLOSS_Syscall(&args);
+
+    return (int)(long)args.arg4;
+}
+
+
+
+int LockRelease(int lock)
+{
+    require_user_mode(__func__);
+
+    USLOSS_Sysargs args;
+    memset(&args, 0, sizeof(args));
+
+    args.number = SYS_LOCKRELEASE;
+    args.arg1 = (void*)(long)lock;
+    USLOSS_Syscall(&args);
+
+    return (int)(long)args.arg4;
+}
+
+
+
 int SemFree(int semaphore)
 {
     require_user_mode(__func__);
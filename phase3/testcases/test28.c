@@ -0,0 +1,55 @@
+/* Tests the YieldTo() syscall
+ *
+ * start3 spawns ChildA, ChildB and ChildC at its own priority, 3, so they
+ * wait on the run queue in that order.  YieldTo(ChildC) runs ChildC
+ * first, then ChildA and ChildB, before start3 gets the CPU back.  YieldTo()
+ * returns 0 for ChildC, 1 (a plain yield) for start3's own pid, and -1 for
+ * a pid that doesn't exist.
+ *
+ * With a phase 1 that has no yieldTo(), such as the prebuilt one, every
+ * call returns -1 and the children run when start3 waits (test28.out-1).
+ */
+
+#include <usloss.h>
+#include <usyscall.h>
+#include <phase1.h>
+#include <phase2.h>
+#include <phase3_usermode.h>
+#include <stdio.h>
+
+#define NO_SUCH_PID  9999
+
+int Child(char *);
+
+
+
+int start3(char *arg)
+{
+    int pid, childC, status;
+
+    USLOSS_Console("start3(): started\n");
+
+    Spawn("ChildA", Child, "ChildA", USLOSS_MIN_STACK, 3, &pid);
+    Spawn("ChildB", Child, "ChildB", USLOSS_MIN_STACK, 3, &pid);
+    Spawn("ChildC", Child, "ChildC", USLOSS_MIN_STACK, 3, &childC);
+
+    USLOSS_Console("start3(): yielding to ChildC\n");
+    USLOSS_Console("start3(): YieldTo(ChildC) returned %d\n", YieldTo(childC));
+
+    GetPID(&pid);
+    USLOSS_Console("start3(): YieldTo(myself) returned %d\n", YieldTo(pid));
+    USLOSS_Console("start3(): YieldTo(%d) returned %d\n", NO_SUCH_PID, YieldTo(NO_SUCH_PID));
+
+    for (int i = 0; i < 3; i++) {
+        Wait(&pid, &status);
+        USLOSS_Console("start3(): child %d returned status %d\n", pid, status);
+    }
+
+    return 0;
+}
+
+int Child(char *arg)
+{
+    USLOSS_Console("%s(): running\n", arg);
+    Terminate(1);
+}
@@ -26,6 +26,7 @@
 #define PARENT(x)   x / 2
 
 #define SEC_TO_SLEEP_CYCLE(x) x * 10
+#define SLEEP_CYCLE_US 100000   // length of a sleep cycle; one clock message
 #define SLEEPING 30
 
 #define MAX_READ_BUFFERS 10
@@ -38,6 +39,15 @@
 
 #define print USLOSS_Console
 
+// newer phase 1/2 calls; with older kernels they are NULL and the
+// fallbacks below (diskRequests, daemons per device, sleep ticks) apply
+#pragma weak registerProcExtension
+#pragma weak myProcExtension
+#pragma weak reschedule
+#pragma weak requestTick
+#pragma weak registerDeviceTask
+#pragma weak MboxSetLock
+
 /* ---------- Data Structures ---------- */
 
 typedef struct PCB {
@@ -50,6 +60,14 @@ typedef struct LineBuffer {
     int size;
 } LineBuffer;
 
+typedef struct TermState {
+    int readBuffers;                // stored lines
+    int fullBuffers;                // num of lines currenty stored
+
+    LineBuffer curRecvBuf;          // line currently being read
+    LineBuffer curRequestedBuf;     // used to temp. store a requested line
+} TermState;
+
 typedef struct DiskState {
     int currentTrack;
     int status;
@@ -82,6 +100,7 @@ long calculateLocation(int, int);
 
 void addToRequestQueue(DiskRequest*, int);
 void fillRequest(DiskRequest*, int, int, int, int, int);
+DiskRequest* myDiskRequest(int);
 void cleanHeap();
 void heapRemove();
 void insert(PCB*);
@@ -99,6 +118,11 @@ void kernelDiskWrite(USLOSS_Sysargs*);
 
 /* ---------- Daemon Prototypes ---------- */
 
+void diskEvent(int, int);
+void sleepEvent(int, int);
+void termEvent(int, int);
+void termStart(int);
+
 int diskDaemonMain(char*);
 int sleepDaemonMain(char*);
 int termDaemonMain(char*);
@@ -107,7 +131,7 @@ int tempDaemon(char*);
 /* ---------- Globals ---------- */
 
 // sleep variables
-PCB sleepHeap[MAXPROC];
+PCB sleepHeap[PROC_TABLE_LIMIT];
 int elementsInHeap = 0;
 
 // terminal variables
@@ -117,9 +141,12 @@ int termWriteMutex[USLOSS_TERM_UNITS];
 int termReadMbox[USLOSS_TERM_UNITS];
 int termReadRequestMbox[USLOSS_TERM_UNITS];
 
+TermState terms[USLOSS_TERM_UNITS];
+
 // disk variables
 DiskState disks[USLOSS_DISK_UNITS];
 DiskRequest diskRequests[USLOSS_DISK_UNITS][MAXPROC];
+int diskRequestExt = -1;    // handle of each process's disk requests in its phase 1 PCB, -1 to use diskRequests (by pid % MAXPROC)
 
 DiskRequest* curRequests[USLOSS_DISK_UNITS];
 DiskRequest* nextRequests[USLOSS_DISK_UNITS];
@@ -142,11 +169,21 @@ void phase4_init(void) {
     memset(disks, 0, sizeof(disks));
     memset(curRequests, 0, sizeof(curRequests));
     memset(nextRequests, 0, sizeof(nextRequests));
+    memset(terms, 0, sizeof(terms));
+    diskRequestExt = -1;
+    if (registerProcExtension) {
+        diskRequestExt = registerProcExtension(USLOSS_DISK_UNITS * sizeof(DiskRequest));
+        if (diskRequestExt < 0) {
+            USLOSS_Console("ERROR: no room for disk requests in phase 1 PCBs\n");
+            USLOSS_Halt(1);
+        }
+    }
 
     // setup ipc stuff for the terminal driver
     for (int i = 0; i < USLOSS_TERM_UNITS; i++) {
         termWriteMutex[i] = MboxCreate(1,0);
         MboxSend(termWriteMutex[i], NULL, 0);
+        if (MboxSetLock) { MboxSetLock(termWriteMutex[i]); }
         termWriteMbox[i] = MboxCreate(1, 0);
         termReadRequestMbox[i] = MboxCreate(1, sizeof(int));
         termReadMbox[i] = MboxCreate(1, MAXLINE);
@@ -162,7 +199,9 @@ void phase4_init(void) {
 
 /**
  * Purpose:
- * Spawns daemon processes used in device drivers
+ * Hooks the device drivers up to their interrupts. Each driver runs as a
+ * kernel task straight from the interrupt when phase 2 supports it, and
+ * otherwise as a daemon process blocked in waitDevice()
  *
  * Parameters:
  * None
@@ -171,6 +210,17 @@ void phase4_init(void) {
  * None
  */
 void phase4_start_service_processes() {
+    if (registerDeviceTask && registerDeviceTask(USLOSS_CLOCK_DEV, 0, sleepEvent) == 0) {
+        for (int i = 0; i < USLOSS_TERM_UNITS; i++) {
+            termStart(i);
+            registerDeviceTask(USLOSS_TERM_DEV, i, termEvent);
+        }
+        for (int i = 0; i < USLOSS_DISK_UNITS; i++) {
+            registerDeviceTask(USLOSS_DISK_DEV, i, diskEvent);
+        }
+        return;
+    }
+
     // sleep daemon
     fork1("Sleep Daemon", sleepDaemonMain, NULL, USLOSS_MIN_STACK, 1);
 
@@ -220,6 +270,8 @@ int kernSleep(int seconds) {
     cur.pid = pid;
     cur.sleepCyclesRemaining = SEC_TO_SLEEP_CYCLE(seconds);
     insert(&cur);
+    // a tickless kernel skips idle ticks, so ask for the end of the first cycle
+    if (requestTick) { requestTick(currentTime() + SLEEP_CYCLE_US); }
     blockMe(SLEEPING);
     return 0;
 }
@@ -246,7 +298,7 @@ void kernelDiskSize(USLOSS_Sysargs* args) {
     // read disk size if not already saved
     if (!disk->tracks) {
         int pid = getpid();
-        DiskRequest* curRequest = &diskRequests[pid % MAXPROC];
+        DiskRequest* curRequest = myDiskRequest(unit);
         fillRequest(curRequest, USLOSS_DISK_TRACKS, -1, 0, pid, 0);
         addToRequestQueue(curRequest, unit);
         // block if not next disk request to handle
@@ -306,7 +358,7 @@ void kernelDiskRead(USLOSS_Sysargs* args) {
     }
     args->arg4 = 0;
 
-    DiskRequest* curRequest = &diskRequests[unit][pid % MAXPROC];
+    DiskRequest* curRequest = myDiskRequest(unit);
     fillRequest(curRequest, USLOSS_DISK_READ, track, block, pid, sectors);
     addToRequestQueue(curRequest, unit);
     
@@ -377,7 +429,7 @@ void kernelDiskWrite(USLOSS_Sysargs* args) {
     }
     args->arg4 = 0;
 
-    DiskRequest* curRequest = &diskRequests[unit][pid % MAXPROC];
+    DiskRequest* curRequest = myDiskRequest(unit);
     fillRequest(curRequest, USLOSS_DISK_READ, track, block, pid, sectors);
     addToRequestQueue(curRequest, unit);
     
@@ -529,19 +581,10 @@ int kernTermWrite(char *buffer, int bufferSize, int unitID, int *numCharsRead) {
 int diskDaemonMain(char* args) {
     int status;
     int unit = (int)(long)args;
-    DiskState* disk = &disks[unit];
 
     while (1) {
         waitDevice(USLOSS_DISK_DEV, unit, &status);
-        disk->status = status;
-
-        // unblock processes if they should be
-        if (status == USLOSS_DEV_READY) {
-            unblockProc(curRequests[unit]->process);
-        }
-        else if (status == USLOSS_DEV_ERROR) {
-            unblockProc(curRequests[unit]->process);
-        }
+        diskEvent(unit, status);
     }
 
     return 0;
@@ -561,7 +604,7 @@ int sleepDaemonMain(char* args) {
     int status;
     while (1) {
         waitDevice(USLOSS_CLOCK_INT, 0, &status);
-        cleanHeap();
+        sleepEvent(0, status);
     }
     return 0;
 }
@@ -578,58 +621,141 @@ int sleepDaemonMain(char* args) {
  */
 int termDaemonMain(char* args) {
     int id = (int)(long) args;
-    USLOSS_DeviceOutput(USLOSS_TERM_DEV, id, (void*)(long)RW_MASK_ON); // unmask interrupts
-
-    int status, statXmit, statRecv; // status stuff
-
-    // read stuff
-    int readBuffers = MboxCreate(MAX_READ_BUFFERS, sizeof(LineBuffer)); // stored lines
-    int fullBuffers = 0;                // num of lines currenty stored
-                                        
-    LineBuffer curRecvBuf;              // line currently being read
-    char curRecvChar;                   // char currently being read
-    curRecvBuf.size = 0;
-                                        
-    LineBuffer curRequestedBuf;         // used to temp. store a requested line
-    int curReqLen;                      // max length requested
-    int curSendLen;                     // length of the actually sent line; <= curReqLen
-    curRequestedBuf.size = 0;
+    int status;
+    termStart(id);
 
     while (1) {
         waitDevice(USLOSS_TERM_DEV, id, &status);
-        statXmit = USLOSS_TERM_STAT_XMIT(status);
-        statRecv = USLOSS_TERM_STAT_RECV(status);
-
-        // handle reading
-        if (statRecv == USLOSS_DEV_BUSY) {
-            curRecvChar = USLOSS_TERM_STAT_CHAR(status);
-            curRecvBuf.buffer[curRecvBuf.size++] = curRecvChar;
-            if (curRecvChar == '\n' || curRecvBuf.size >= MAXLINE) {
-                if (MboxCondSend(readBuffers, &curRecvBuf, sizeof(curRecvBuf)) >= 0) {
-                    fullBuffers++;
-                }
-                memset(&curRecvBuf, 0, sizeof(curRecvBuf));
+        termEvent(id, status);
+    }
+    return 0;
+}
+
+/**
+ * Purpose:
+ * Handles one disk interrupt, waking the process whose request finished.
+ * Runs as a kernel task or from the disk daemon, so it must not block
+ *
+ * Parameters:
+ * int unit     disk unit that interrupted
+ * int status   status of the disk
+ *
+ * Return:
+ * None
+ */
+void diskEvent(int unit, int status) {
+    DiskState* disk = &disks[unit];
+    disk->status = status;
+
+    // unblock processes if they should be
+    if (status == USLOSS_DEV_READY) {
+        unblockProc(curRequests[unit]->process);
+    }
+    else if (status == USLOSS_DEV_ERROR) {
+        unblockProc(curRequests[unit]->process);
+    }
+}
+
+/**
+ * Purpose:
+ * Handles one clock message, waking any sleepers whose time is up. Runs as
+ * a kernel task or from the sleep daemon, so it must not block. While
+ * anyone is still asleep it asks a tickless kernel for the next cycle's
+ * tick; with no sleepers the clock is left idle
+ *
+ * Parameters:
+ * int unit     clock unit, always 0
+ * int status   time of the clock message
+ *
+ * Return:
+ * None
+ */
+void sleepEvent(int unit, int status) {
+    cleanHeap();
+    if (elementsInHeap > 0 && requestTick) { requestTick(status + SLEEP_CYCLE_US); }
+}
+
+/**
+ * Purpose:
+ * Sets up a terminal for its driver: unmasks its interrupts and creates
+ * the mailbox that holds lines read but not yet requested
+ *
+ * Parameters:
+ * int unit     which terminal to set up
+ *
+ * Return:
+ * None
+ */
+void termStart(int unit) {
+    TermState* term = &terms[unit];
+    USLOSS_DeviceOutput(USLOSS_TERM_DEV, unit, (void*)(long)RW_MASK_ON); // unmask interrupts
+    term->readBuffers = MboxCreate(MAX_READ_BUFFERS, sizeof(LineBuffer));
+}
+
+/**
+ * Purpose:
+ * Handles one terminal interrupt: stores a received char, hands a finished
+ * line to a waiting reader, and lets the next writer go. Runs as a kernel
+ * task or from the terminal daemon, so only uses non-blocking mailbox calls
+ *
+ * Parameters:
+ * int unit     which terminal interrupted
+ * int status   status of the terminal
+ *
+ * Return:
+ * None
+ */
+void termEvent(int unit, int status) {
+    TermState* term = &terms[unit];
+    int statXmit = USLOSS_TERM_STAT_XMIT(status);
+    int statRecv = USLOSS_TERM_STAT_RECV(status);
+    int curReqLen;                      // max length requested
+    int curSendLen;                     // length of the actually sent line; <= curReqLen
+
+    // handle reading
+    if (statRecv == USLOSS_DEV_BUSY) {
+        char curRecvChar = USLOSS_TERM_STAT_CHAR(status);
+        term->curRecvBuf.buffer[term->curRecvBuf.size++] = curRecvChar;
+        if (curRecvChar == '\n' || term->curRecvBuf.size >= MAXLINE) {
+            if (MboxCondSend(term->readBuffers, &term->curRecvBuf, sizeof(LineBuffer)) >= 0) {
+                term->fullBuffers++;
             }
+            memset(&term->curRecvBuf, 0, sizeof(LineBuffer));
         }
-        if (fullBuffers > 0 && MboxCondRecv(termReadRequestMbox[id], &curReqLen, sizeof(int)) >= 0) {
-            MboxCondRecv(readBuffers, &curRequestedBuf, sizeof(LineBuffer));
-            fullBuffers--;
-            if (curReqLen < curRequestedBuf.size) { curSendLen = curReqLen; }
-            else { curSendLen = curRequestedBuf.size; }
-            MboxCondSend(termReadMbox[id], &curRequestedBuf.buffer, curSendLen);
-            memset(&curRequestedBuf, 0, sizeof(curRequestedBuf));
-        }
+    }
+    if (term->fullBuffers > 0 && MboxCondRecv(termReadRequestMbox[unit], &curReqLen, sizeof(int)) >= 0) {
+        MboxCondRecv(term->readBuffers, &term->curRequestedBuf, sizeof(LineBuffer));
+        term->fullBuffers--;
+        if (curReqLen < term->curRequestedBuf.size) { curSendLen = curReqLen; }
+        else { curSendLen = term->curRequestedBuf.size; }
+        MboxCondSend(termReadMbox[unit], &term->curRequestedBuf.buffer, curSendLen);
+        memset(&term->curRequestedBuf, 0, sizeof(LineBuffer));
+    }
 
-        // handle writing
-        if (statXmit == USLOSS_DEV_READY) {
-            MboxCondSend(termWriteMbox[id], NULL, 0);
-        }
+    // handle writing
+    if (statXmit == USLOSS_DEV_READY) {
+        MboxCondSend(termWriteMbox[unit], NULL, 0);
     }
-    return 0;
 }
 
 /* ---------- Helper Functions ---------- */
 
+/**
+ * Purpose:
+ * Finds the current process's request for a disk, kept in its phase 1 PCB,
+ * or in diskRequests with a phase 1 that has no PCB extensions
+ *
+ * Parameters:
+ * int unit     disk the request is for
+ *
+ * Return:
+ * DiskRequest*     the current process's request for that disk
+ */
+DiskRequest* myDiskRequest(int unit) {
+    if (diskRequestExt >= 0) { return (DiskRequest*)myProcExtension(diskRequestExt) + unit; }
+    return &diskRequests[unit][getpid() % MAXPROC];
+}
+
 /**
  * Purpose:
  * Fills in information for a disk request
@@ -737,7 +863,8 @@ int validateTermArgs(char* buffer, int bufferSize, int unitID) {
  * Purpose:
  * Goes through heap of sleeping processes and decrements how many more cycles
  * are remaining for each one sleeping. Then goes through and cleans any process
- * with no time remaining on sleep
+ * with no time remaining on sleep. Interrupts stay off while the sleepers are
+ * woken, so phase 1 can batch the wakeups into a single dispatch
  *
  * Parameters:
  * None
@@ -749,9 +876,13 @@ void cleanHeap() {
     for (int i = 0; i < elementsInHeap; i++) {
         sleepHeap[i].sleepCyclesRemaining--;
     }
+    int psr = USLOSS_PsrGet();
+    USLOSS_PsrSet(psr & ~USLOSS_PSR_CURRENT_INT);
     while (elementsInHeap > 0 && sleepHeap[0].sleepCyclesRemaining <= 0) {
         heapRemove();
     }
+    USLOSS_PsrSet(psr);
+    if (reschedule) { reschedule(); }
 }
 
 /**